@@ -15,10 +15,32 @@
 #include <i3ds/publisher.hpp>
 #include <i3ds/tof_camera_sensor.hpp>
 #include <i3ds/trigger_client.hpp>
+#include <i3ds/analog_sensor.hpp>
+#include <i3ds/camera_sensor.hpp>
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "basler_tof_wrapper.hpp"
+#include "basler_tof_housekeeping.hpp"
+#include "rate_governor.hpp"
+#include "frame_mailbox.hpp"
+#include "latency_histogram.hpp"
+#include "shm_frame_ring.hpp"
+#include "tof_wire_encoder.hpp"
+#include "change_gate.hpp"
+#include "trigger_timeline.hpp"
+#include "depth_range_adapter.hpp"
+#include "device_executor.hpp"
+#include "frame_batcher.hpp"
+#include "tof_normals.hpp"
+#include "tof_undistort.hpp"
+#include "frame_history.hpp"
+#include "thermal_compensation.hpp"
 
 
 namespace i3ds
@@ -28,6 +50,14 @@ class BaslerToFCamera : public ToFCamera
 {
 public:
 
+  // Additional output stream published on its own node.
+  struct StreamParameters
+  {
+    NodeID node;
+    int level;   // Pyramid level, resolution is halved per level.
+    int divider; // Publish every n-th frame.
+  };
+
   struct Parameters
   {
     std::string camera_name;
@@ -35,7 +65,75 @@ public:
     TriggerGenerator trigger_source;
     TriggerOutput camera_output;
     TriggerOffset camera_offset;
+    SamplePeriod publish_period;
+    bool latest_only;
+    std::vector<StreamParameters> streams;
+    NodeID telemetry_node;
+    int telemetry_period; // Milliseconds, zero disables telemetry.
+    int temperature_period; // Milliseconds, polling of temperature and link status.
+    int limits_period;      // Milliseconds, polling of depth limits and processing mode.
+    int shm_slots;          // Slots in shared memory ring, zero disables it.
+    bool shm_only;          // Publish to shared memory only, not on the network.
+    bool direct_encoding;   // Encode frames straight from the raw planes.
+    bool intensity;         // Enable intensity component, published as image.
+    NodeID intensity_node;
+    int min_intensity;      // Pixels with lower intensity are invalid, zero disables.
+    double min_valid;       // Meters, distances outside are invalid, zero disables.
+    double max_valid;       // Meters, zero is no upper bound.
+    double change_threshold; // Meters, mean change of a tile to publish, zero disables.
+    double change_fraction;  // Fraction of tiles changed to publish.
+    int keyframe_period;     // Milliseconds, full frame published at least this often.
+    bool change_region;      // Publish only the region of changed tiles.
+    bool auto_range;         // Adapt depth range to the scene while sampling.
+    int auto_range_period;   // Frames between adaptations.
+    int batch_frames;        // Frames per message on batch_node, below 2 disables.
+    NodeID batch_node;
+    int batch_latency;       // Microseconds, from first frame in a batch to send.
+    int normals_stride;      // Pixels between surface normals, zero disables.
+    int normals_radius;      // Pixels, window for each normal.
+    int normals_threads;
+    NodeID normals_node;
+    double fov_x;            // Degrees, pinhole model of the full sensor.
+    double fov_y;
+    UndistortMode undistort; // Remap frames to an ideal pinhole camera.
+    LensModel lens;
+    int history_budget;      // Megabytes of raw frames kept for dumps, zero disables.
+    std::vector<ThermalCompensation::Entry> thermal_table; // Empty disables.
+  };
 
+  // Layout of the samples in the telemetry topic. Counters are totals since
+  // activation, times are in microseconds over the last telemetry period.
+  enum TelemetrySample
+  {
+    telemetry_acquired,
+    telemetry_published,
+    telemetry_decimated,
+    telemetry_discarded,
+    telemetry_timeouts,
+    telemetry_queue_depth,
+    telemetry_convert_p50,
+    telemetry_convert_p99,
+    telemetry_publish_p50,
+    telemetry_publish_p99,
+    telemetry_sampler_cpu_time, // Seconds
+    telemetry_temperature,      // Kelvin
+    telemetry_unchanged,        // Frames suppressed by the change gate.
+    telemetry_trigger_grab_p50, // Trigger pulse to frame arrival, external trigger only.
+    telemetry_trigger_grab_p99,
+    telemetry_trigger_publish_p50,
+    telemetry_trigger_publish_p99,
+    telemetry_trigger_jitter,   // Spread of trigger to arrival latency.
+    telemetry_trigger_missed,   // Pulses without a frame.
+    telemetry_driver_gaps,      // Frame IDs skipped by the camera driver.
+    telemetry_grab_drops,       // Buffers failed or not delivered.
+    telemetry_command_p50,      // Device command submit to completion.
+    telemetry_command_p99,
+    telemetry_commands_coalesced,
+    telemetry_normals_p50,      // Surface normal estimation.
+    telemetry_normals_p99,
+    telemetry_thermal_offset,   // Meters, depth correction for temperature.
+    telemetry_thermal_scale,
+    telemetry_samples
   };
 
 
@@ -60,6 +158,20 @@ public:
 
   void set_error_state(const std::string & error_message, bool dont_throw);
 
+  // Frames not published because of the output rate.
+  uint64_t frames_decimated() const {return governor_.dropped();}
+
+  // Frames replaced by a fresher one before they were published.
+  uint64_t frames_discarded() const {return mailbox_ ? mailbox_->discarded() : 0;}
+
+  // Frames not published because the scene did not change.
+  uint64_t frames_unchanged() const {return frames_unchanged_;}
+
+  // Writes the raw frames of the last window_ms from the history to a
+  // recording, returns the number of frames or -1 on failure. Does not
+  // block sampling.
+  long dump_history(const std::string &path, int window_ms);
+
 protected:
   // Actions.
   virtual void do_activate();
@@ -75,17 +187,126 @@ private:
 
   const Parameters param_;
 
-  bool send_sample ( const uint16_t *depth, const uint16_t *confidence, int width, int height );
+  bool send_sample ( const uint16_t *depth, const uint16_t *confidence, const uint16_t *intensity,
+                     int width, int height, int offset_x, int offset_y );
+
+  void send_loop();
+  void batch_loop();
+  void stop_sender();
+  void send_batched(const ToFCamera::MeasurementTopic::Data &frame, uint64_t frame_number);
+  void flush_batch();
+  void send_shm(const ToFCamera::MeasurementTopic::Data &frame, uint64_t sequence, uint64_t frame_number);
+  void send_intensity(const uint16_t *intensity, int width, int height, int offset_x, int offset_y,
+                      Timepoint timestamp);
+  void verify_encoder(const uint16_t *depth, const uint16_t *confidence, const DepthScale &scale,
+                      const ToFCamera::MeasurementTopic::Data &frame);
+  void send_streams(ToFCamera::MeasurementTopic::Data &frame);
+  void send_normals(const ToFCamera::MeasurementTopic::Data &frame);
+  void count_published(Timepoint grabbed);
+  void update_range(const uint16_t *depth, const uint16_t *confidence, int size);
+  void crop_frame(ToFCamera::MeasurementTopic::Data &frame, const ChangeGate::Decision &change);
+
+  void start_telemetry();
+  void stop_telemetry();
+  void telemetry_loop();
 
   void set_trigger(TriggerOutput channel, TriggerOffset offset);
   void clear_trigger(TriggerOutput channel);
 
   Publisher publisher_;
 
+  // Preallocated for the full sensor, reused for every region.
+  std::unique_ptr<ToFCamera::MeasurementTopic::Data> frame_;
+
+  RateGovernor governor_;
+
+  // Used in latest-only mode, frames are published from sender_.
+  std::unique_ptr<FrameMailbox<ToFCamera::MeasurementTopic::Data>> mailbox_;
+  std::thread sender_;
+
+  // Frames for consumers on the same host.
+  std::unique_ptr<ShmFrameWriter> shm_;
+
+  // Used for the frames not needed by other outputs, once verified.
+  std::unique_ptr<ToFWireEncoder> encoder_;
+  bool encoder_verified_;
+
+  // Frames packed into one message each, instead of publishing each frame.
+  // Batches not filled by the deadline are sent from sender_, since the
+  // next frame may be late or never come.
+  std::unique_ptr<FrameBatcher> batcher_;
+  std::unique_ptr<Publisher> batch_publisher_;
+  std::mutex batch_mutex_;
+  std::condition_variable batch_cond_;
+  bool batch_running_;
+
+  // Intensity image refers to the camera buffer, it is not copied.
+  std::unique_ptr<Publisher> intensity_publisher_;
+  Camera::FrameTopic::Data intensity_frame_;
+
+  // Depth correction for the temperature polled by housekeeping.
+  std::unique_ptr<ThermalCompensation> thermal_;
+
+  // Raw frames before conversion, for dumps after an event.
+  std::unique_ptr<FrameHistory> history_;
+
+  // Raw planes remapped by a table per region, before any other use.
+  std::unique_ptr<Undistortion> undistortion_;
+
+  // Surface normals and planarity, published as one mono image per channel.
+  std::unique_ptr<SurfaceNormals> normals_;
+  std::unique_ptr<Publisher> normals_publisher_;
+  Camera::FrameTopic::Data normals_frame_;
+
+  struct Stream
+  {
+    StreamParameters param;
+    std::unique_ptr<Publisher> publisher;
+  };
+
+  std::vector<Stream> streams_;
+
+  // Pyramid levels 1 and up, computed only when a stream is due.
+  std::vector<std::unique_ptr<ToFCamera::MeasurementTopic::Data>> levels_;
+
+  uint64_t frame_count_;
+
+  // Compares raw depth with the last published frame, if enabled.
+  std::unique_ptr<ChangeGate> change_gate_;
+
+  // Updated lock-free by the sampling thread, read by telemetry.
+  std::atomic<uint64_t> frames_published_;
+  std::atomic<uint64_t> frames_unchanged_;
+  LatencyHistogram convert_time_;
+  LatencyHistogram publish_time_;
+  LatencyHistogram normals_time_;
+
+  // Trigger pulses reconstructed from the generator setup.
+  TriggerTimeline trigger_timeline_;
+
+  std::unique_ptr<Publisher> telemetry_publisher_;
+  std::thread telemetry_;
+  std::mutex telemetry_mutex_;
+  std::condition_variable telemetry_cond_;
+  bool telemetry_running_;
+
+  // Depth range of the frame being converted, in meters.
   double max_depth_;
   double min_depth_;
 
+  // Proposes new depth ranges in auto range mode, from the sampling thread.
+  std::unique_ptr<DepthRangeAdapter> range_adapter_;
+  BaslerToFWrapper::DepthRange depth_range_;
+
   mutable BaslerToFWrapper *camera_;
+
+  // Device commands from the service handlers are run on its thread.
+  std::unique_ptr<DeviceExecutor> executor_;
+  int64_t sensor_width_;
+  int64_t sensor_height_;
+
+  // Device values read by control and sampling, polled off their threads.
+  std::unique_ptr<BaslerToFHousekeeping> housekeeping_;
   TriggerClient::Ptr trigger_;
   TriggerOutputSet trigger_outputs_;
 };
@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BASLER_TOF_GRAB_HANDLER_HPP
+#define __BASLER_TOF_GRAB_HANDLER_HPP
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <ConsumerImplHelper/ToFCamera.h>
+
+// Does sampling operation, returns true if more samples are requested.
+// Intensity is nullptr when the intensity component is disabled.
+typedef std::function<bool(const uint16_t *depth,
+                           const uint16_t *confidence,
+                           const uint16_t *intensity,
+                           int width,
+                           int height,
+                           int offset_x,
+                           int offset_y)> Operation;
+
+// Used to signal upwards that it is an error and make the system go to failure state
+typedef std::function<void(const std::string error_message, const bool dont_throw)> Error_signaler;
+
+// Handles grab results on the sampling thread: dispatches buffer parts by
+// type, counts timeouts and flags errors. Independent of the device, so it can
+// be driven by a scripted frame source.
+class BaslerToFGrabHandler
+{
+public:
+
+  // Consecutive timeouts before going to error.
+  static const int max_timeouts = 10;
+
+  BaslerToFGrabHandler(Operation operation);
+
+  // Clear error state and timeout counter before grabbing is started.
+  void Reset();
+
+  // Forget the last frame ID when grabbing is restarted, frames lost in
+  // between are not gaps in the driver and IDs may start over.
+  void ResetFrameId() {last_frame_id_ = 0;}
+
+  // Returns false if grabbing shall stop because of an error.
+  bool Handle(const GenTLConsumerImplHelper::GrabResult &result,
+              const GenTLConsumerImplHelper::BufferParts &parts,
+              bool connected, int offset_x, int offset_y);
+
+  // Only to be read by the sampling thread, or after it is joined.
+  bool ErrorFlagged() const {return error_flagged_;}
+  const std::string &ErrorMessage() const {return error_message_;}
+
+  // Signals the error flagged, if any, once grabbing has stopped. Returns
+  // true if there was one.
+  bool SignalError(const Error_signaler &error_signaler) const;
+
+  // Frame ID of the buffer being handled, for the sampling thread.
+  uint64_t FrameId() const {return last_frame_id_;}
+
+  // Statistics, safe to read from any thread.
+  uint64_t FramesAcquired() const {return frames_acquired_;}
+
+  // Frame IDs skipped by the driver, and buffers failed or not delivered.
+  uint64_t DriverGaps() const {return driver_gaps_;}
+  uint64_t GrabDrops() const {return grab_drops_;}
+  uint64_t Timeouts() const {return timeouts_;}
+  double SamplerCpuTime() const {return 1.0e-9 * sampler_cpu_time_;}
+
+private:
+
+  void SetError(const std::string &error_message);
+
+  const Operation operation_;
+
+  int timeout_counter_;
+  bool error_flagged_;
+  std::string error_message_;
+
+  // Frame ID of the last buffer, zero before the first after Reset().
+  uint64_t last_frame_id_;
+
+  std::atomic<uint64_t> frames_acquired_;
+  std::atomic<uint64_t> driver_gaps_;
+  std::atomic<uint64_t> grab_drops_;
+  std::atomic<uint64_t> timeouts_;
+  std::atomic<int64_t> sampler_cpu_time_;
+};
+
+#endif
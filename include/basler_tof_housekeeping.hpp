@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BASLER_TOF_HOUSEKEEPING_HPP
+#define __BASLER_TOF_HOUSEKEEPING_HPP
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "basler_tof_wrapper.hpp"
+
+// Polls slow-changing device values on its own thread. Readers get the last
+// snapshot without touching the device.
+class BaslerToFHousekeeping
+{
+public:
+
+  struct Status
+  {
+    float temperature;              // Celsius
+    bool connected;
+
+    int64_t min_depth;              // Millimeters
+    int64_t max_depth;
+    int64_t min_depth_lower_limit;
+    int64_t max_depth_upper_limit;
+
+    float min_trigger_rate;         // Hz
+    float max_trigger_rate;
+
+    std::string processing_mode;
+  };
+
+  typedef std::shared_ptr<const Status> StatusPtr;
+
+  // Periods in milliseconds, for temperature and link status, and for depth
+  // limits and processing mode respectively.
+  BaslerToFHousekeeping(BaslerToFWrapper &camera, int temperature_period, int limits_period);
+  ~BaslerToFHousekeeping();
+
+  // Polls all values once before the thread is started, throws on failure.
+  void Start();
+  void Stop();
+
+  StatusPtr GetStatus() const {return std::atomic_load(&status_);}
+
+  // Update with values written to the device by the caller.
+  void UpdateDepth(int64_t min_depth, int64_t max_depth);
+  void UpdateTriggerRate(float min_trigger_rate, float max_trigger_rate);
+
+private:
+
+  void PollTemperature(Status &status);
+  void PollLimits(Status &status);
+  void Loop();
+
+  BaslerToFWrapper &camera_;
+
+  const int temperature_period_;
+  const int limits_period_;
+
+  StatusPtr status_;
+
+  // Serializes updates of the snapshot, readers do not take it.
+  std::mutex update_mutex_;
+  uint64_t depth_generation_;
+  uint64_t rate_generation_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool running_;
+  std::thread thread_;
+};
+
+#endif
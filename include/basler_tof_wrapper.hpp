@@ -12,18 +12,12 @@
 #define __BASLER_TOF_WRAPPER_HPP
 
 #include <thread>
+#include <mutex>
+#include <atomic>
 
 #include <ConsumerImplHelper/ToFCamera.h>
 
-// Does sampling operation, returns true if more samples are requested.
-typedef std::function<bool(const uint16_t *depth,
-                           const uint16_t *confidence,
-                           int width,
-                           int height)> Operation;
-
-
-// Used to signal upwards that it is an error and make the system go to failure state
-typedef std::function<void(const std::string error_message, const bool dont_throw)> Error_signaler;
+#include "basler_tof_grab_handler.hpp"
 
 using namespace GenTLConsumerImplHelper;
 
@@ -31,7 +25,23 @@ class BaslerToFWrapper
 {
 public:
 
-  BaslerToFWrapper(std::string camera_name, Operation operation, Error_signaler error_signaler);
+  // Region of interest on the sensor, in pixels.
+  struct Region
+  {
+    int64_t offset_x;
+    int64_t offset_y;
+    int64_t width;
+    int64_t height;
+  };
+
+  // Depth range of the raw depth values, in millimeters.
+  struct DepthRange
+  {
+    int64_t min_depth;
+    int64_t max_depth;
+  };
+
+  BaslerToFWrapper(std::string camera_name, bool intensity, Operation operation, Error_signaler error_signaler);
   ~BaslerToFWrapper();
 
   void Start();
@@ -50,6 +60,13 @@ public:
   void setOffsetX(int64_t value);
   void setOffsetY(int64_t value);
 
+  // Set region of interest. While sampling, the region is staged and
+  // committed between two frames by the sampling thread.
+  void setRegion(const Region &region);
+
+  // Region last set, staged or in effect, without reading the camera.
+  Region GetRegion();
+
   float getTriggerRate();
   float minTriggerRate();
   float maxTriggerRate();
@@ -66,11 +83,29 @@ public:
   void setMinDepth(int64_t depth);
   int64_t getMinDepth_lower_limit();
 
+  // Set depth range. While sampling, the range is staged and committed
+  // between two frames by the sampling thread, like the region.
+  void setDepthRange(const DepthRange &range);
+
+  // Range in effect for the frame being handled, for the sampling thread.
+  const DepthRange &ActiveDepthRange() const {return active_depth_;}
+
   float getTemperature();
 
   std::string GetDeviceModelName();
 
-  const Operation operation_;
+  bool IsConnected();
+
+  // Statistics from the sampling thread, safe to read from any thread.
+  uint64_t FramesAcquired() const {return handler_.FramesAcquired();}
+  uint64_t Timeouts() const {return handler_.Timeouts();}
+  uint64_t DriverGaps() const {return handler_.DriverGaps();}
+  uint64_t GrabDrops() const {return handler_.GrabDrops();}
+
+  // Camera frame ID of the frame being handled, for the sampling thread.
+  uint64_t FrameId() const {return handler_.FrameId();}
+  double SamplerCpuTime() const {return handler_.SamplerCpuTime();}
+
   const Error_signaler error_signaler_;
 
   std::string getEnum(const char *name );
@@ -90,18 +125,34 @@ private:
 
   void setSelector(std::string component, bool value);
 
+  void ApplyRegion(const Region &region);
+  void ApplyDepthRange(const DepthRange &range);
+  void CommitStaged();
+
   bool HandleResult(GrabResult result, BufferParts parts);
   void SampleLoop();
-  void set_error_status(const std::string  st);
 
   CToFCamera camera_;
 
+  // Region in effect for the frames currently being grabbed.
+  Region active_region_;
+
+  // Region staged by setRegion() while sampling, guarded by region_mutex_.
+  std::mutex region_mutex_;
+  Region staged_region_;
+  std::atomic<bool> region_pending_;
+
+  // Depth range in effect and staged, the latter guarded by region_mutex_.
+  DepthRange active_depth_;
+  DepthRange staged_depth_;
+  std::atomic<bool> depth_pending_;
+
+  BaslerToFGrabHandler handler_;
+
   std::thread sampler_;
-  bool running_;
-  int error_counter_;
-  int timeout_counter_;
-  bool error_flagged_;
-  std::string flagged_error_message_;
+
+  // Cleared by Stop() on the control thread, read by the sampling thread.
+  std::atomic<bool> running_;
 };
 
 #endif
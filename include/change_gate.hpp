@@ -0,0 +1,72 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __CHANGE_GATE_HPP
+#define __CHANGE_GATE_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace i3ds
+{
+
+// Decides if a frame differs enough from the last published frame to be
+// published, by the mean absolute difference of raw depth per tile.
+class ChangeGate
+{
+public:
+
+  static const int tile = 16;
+
+  struct Decision
+  {
+    bool publish;
+    bool keyframe;
+
+    // Bounding box of changed tiles in pixels, x1 and y1 exclusive.
+    int x0, y0, x1, y1;
+
+    int changed;
+    int tiles;
+  };
+
+  ChangeGate(int max_pixels);
+
+  // Fraction of tiles changed to publish, keyframe period in microseconds.
+  void configure(double min_changed, int64_t keyframe_period);
+
+  // Next frame is published as keyframe.
+  void reset();
+
+  // Compare frame with the reference, threshold is the raw depth difference.
+  // A frame of another region than the reference is a keyframe.
+  Decision evaluate(const uint16_t *depth, int offset_x, int offset_y, int width, int height,
+                    uint32_t threshold, int64_t now);
+
+  // Frame is published, the part inside the box becomes the reference.
+  void commit(const uint16_t *depth, const Decision &decision, int64_t now);
+
+private:
+
+  std::vector<uint16_t> reference_;
+
+  int offset_x_;
+  int offset_y_;
+  int width_;
+  int height_;
+
+  double min_changed_;
+  int64_t keyframe_period_;
+  int64_t last_keyframe_;
+};
+
+} // namespace i3ds
+
+#endif
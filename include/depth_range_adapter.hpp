@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DEPTH_RANGE_ADAPTER_HPP
+#define __DEPTH_RANGE_ADAPTER_HPP
+
+#include <cstdint>
+
+namespace i3ds
+{
+
+// Proposes a depth range that fits the scene, from a histogram of valid
+// depths over the device limits. The histogram is fed a subsample of every
+// frame and decays by half every period. Depths are in millimeters.
+class DepthRangeAdapter
+{
+public:
+
+  static const int bins = 256;
+
+  // Every n-th pixel is added to the histogram.
+  static const int stride = 4;
+
+  // Device limits of the range, evaluation period in frames.
+  DepthRangeAdapter(int64_t lower_limit, int64_t upper_limit, int period);
+
+  // Add frame with raw depth scaled to [min_depth, max_depth]. Returns true
+  // if a new range is proposed.
+  bool add(const uint16_t *depth, const uint16_t *confidence, int size,
+           int64_t min_depth, int64_t max_depth, int64_t *new_min, int64_t *new_max);
+
+private:
+
+  bool propose(int64_t min_depth, int64_t max_depth, int64_t *new_min, int64_t *new_max);
+
+  // Depth at the p-quantile of the histogram.
+  int64_t percentile(double p) const;
+
+  const int64_t lower_limit_;
+  const int64_t upper_limit_;
+  const int period_;
+
+  int frames_;
+
+  uint32_t count_[bins];
+  uint64_t total_;
+
+  // Pixels at the ends of the raw range, the scene may extend beyond.
+  uint64_t low_edge_;
+  uint64_t high_edge_;
+};
+
+} // namespace i3ds
+
+#endif
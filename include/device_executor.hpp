@@ -0,0 +1,82 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DEVICE_EXECUTOR_HPP
+#define __DEVICE_EXECUTOR_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "latency_histogram.hpp"
+
+namespace i3ds
+{
+
+// Runs device commands in order on its own thread, so the caller is not
+// blocked by device access. A command submitted while another with the same
+// key is still queued replaces it, so only the last of a burst is applied.
+// Failures are reported through the error handler.
+class DeviceExecutor
+{
+public:
+
+  typedef std::function<void()> Command;
+  typedef std::function<void(const std::string &error_message)> ErrorHandler;
+
+  DeviceExecutor(ErrorHandler error_handler);
+  ~DeviceExecutor();
+
+  void Submit(const std::string &key, Command command);
+
+  // Wait for all queued commands to complete.
+  void Drain();
+
+  // Submit to completion, in microseconds.
+  LatencyHistogram &Latency() {return latency_;}
+
+  uint64_t Coalesced() const {return coalesced_;}
+
+private:
+
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry
+  {
+    std::string key;
+    Command command;
+    Clock::time_point submitted;
+  };
+
+  void Loop();
+
+  const ErrorHandler error_handler_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable idle_cond_;
+  std::deque<Entry> queue_;
+  bool busy_;
+  bool running_;
+
+  std::atomic<uint64_t> coalesced_;
+  LatencyHistogram latency_;
+
+  std::thread thread_;
+};
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRAME_BATCHER_HPP
+#define __FRAME_BATCHER_HPP
+
+#include <i3ds/tof_camera_sensor.hpp>
+#include <i3ds/publisher.hpp>
+#include <i3ds/time.hpp>
+
+#include <vector>
+
+namespace i3ds
+{
+
+// Packs consecutive measurements into one message, one payload part per
+// frame, each encoded as a complete ToFCamera::MeasurementTopic with its own
+// timestamp and region. Meant for small regions at high rates, where the
+// cost per message dominates.
+class FrameBatcher
+{
+public:
+
+  // Max latency in microseconds, from the first frame in a batch to send.
+  FrameBatcher(NodeID node, int max_frames, int64_t max_latency);
+
+  // Encode the frame into the batch, returns false if it did not fit.
+  bool Add(const ToFCamera::MeasurementTopic::Data &frame);
+
+  // True if the batch is full, or the next frame, expected after period,
+  // would be later than the latency bound.
+  bool Due(Timepoint now, int64_t period) const;
+
+  // Time the batch must be sent by, if there are frames.
+  Timepoint Deadline() const {return timestamps_.front() + max_latency_;}
+
+  // Fits a frame of this many pixels.
+  bool Fits(int pixels) const;
+
+  // Send the frames batched, if any.
+  void Flush(Publisher &publisher);
+
+  int Frames() const {return (int) timestamps_.size();}
+
+  // Timestamps of the frames in the batch, before it is flushed.
+  const std::vector<Timepoint> &Timestamps() const {return timestamps_;}
+
+private:
+
+  const NodeID node_;
+  const int max_frames_;
+  const int64_t max_latency_;
+
+  // Encoded frames back to back, with their end offsets.
+  std::vector<byte> buffer_;
+  std::vector<size_t> ends_;
+  std::vector<Timepoint> timestamps_;
+};
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,75 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRAME_HISTORY_HPP
+#define __FRAME_HISTORY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "tof_recording.hpp"
+
+namespace i3ds
+{
+
+// Ring of the last raw frames, so the frames before an event can be dumped
+// after it. Depth and confidence are kept as uint16 in slots for the full
+// sensor, as many as fit in the memory budget, all allocated up front.
+//
+// As in the shared memory ring, each slot is guarded by a sequence number,
+// odd while the slot is written. A dump copies frames without blocking the
+// sampling thread, and skips frames overwritten while they were copied.
+class FrameHistory
+{
+public:
+
+  FrameHistory(size_t budget, size_t max_pixels);
+
+  int Slots() const {return slots_;}
+
+  // Called by the sampling thread for every frame.
+  void Store(const ToFRecordHeader &header, const uint16_t *depth, const uint16_t *confidence);
+
+  struct DumpResult
+  {
+    long written; // Frames written, -1 if the file could not be written.
+    long dropped; // Frames in the ring overwritten before they were copied.
+  };
+
+  // Writes frames with timestamp in [from, to] to a recording, oldest first.
+  // May be called from any thread, but only one at a time.
+  DumpResult Dump(const std::string &path, int64_t from, int64_t to) const;
+
+private:
+
+  struct Slot
+  {
+    std::atomic<uint64_t> seq;
+    ToFRecordHeader header;
+  };
+
+  uint16_t *depth(uint64_t frame) const;
+  uint16_t *confidence(uint64_t frame) const;
+
+  const size_t max_pixels_;
+  const int slots_;
+
+  std::unique_ptr<Slot[]> slot_;
+  std::unique_ptr<uint16_t[]> planes_;
+
+  std::atomic<uint64_t> latest_; // Number of the last complete frame, 0 if none
+};
+
+} // namespace i3ds
+
+#endif
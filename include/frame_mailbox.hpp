@@ -0,0 +1,135 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __FRAME_MAILBOX_HPP
+#define __FRAME_MAILBOX_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace i3ds
+{
+
+// Single slot mailbox with three preallocated buffers. The producer fills
+// back() and posts it, the consumer always receives the freshest frame.
+// A posted frame not yet taken by the consumer is discarded as stale.
+template<typename T>
+class FrameMailbox
+{
+public:
+
+  typedef std::function<void(T&)> Initializer;
+
+  FrameMailbox(Initializer initialize)
+    : back_(new T), mail_(new T), front_(new T), mail_tag_(0), full_(false), closed_(true), discarded_(0)
+  {
+    initialize(*back_);
+    initialize(*mail_);
+    initialize(*front_);
+  }
+
+  // Buffer owned by the producer.
+  T& back() {return *back_;}
+
+  // Hand the back buffer over to the consumer, with a tag identifying it.
+  void post(uint64_t tag = 0)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      if (full_)
+        {
+          discarded_++;
+        }
+
+      std::swap(back_, mail_);
+      mail_tag_ = tag;
+      full_ = true;
+    }
+
+    cond_.notify_one();
+  }
+
+  // Wait for a frame, returns nullptr when the mailbox is closed.
+  T* take(uint64_t *tag = nullptr)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    cond_.wait(lock, [this] {return full_ || closed_;});
+
+    if (!full_)
+      {
+        return nullptr;
+      }
+
+    std::swap(mail_, front_);
+    full_ = false;
+
+    if (tag)
+      {
+        *tag = mail_tag_;
+      }
+
+    return front_.get();
+  }
+
+  void open()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    full_ = false;
+    closed_ = false;
+  }
+
+  // Wakes the consumer, a frame still in the mailbox is discarded.
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      if (full_)
+        {
+          discarded_++;
+        }
+
+      full_ = false;
+      closed_ = true;
+    }
+
+    cond_.notify_all();
+  }
+
+  uint64_t discarded() const {return discarded_;}
+
+  // Number of frames waiting for the consumer.
+  int depth() const {return full_ ? 1 : 0;}
+
+private:
+
+  std::unique_ptr<T> back_;
+  std::unique_ptr<T> mail_;
+  std::unique_ptr<T> front_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+
+  uint64_t mail_tag_;
+  std::atomic<bool> full_;
+  bool closed_;
+
+  std::atomic<uint64_t> discarded_;
+};
+
+} // namespace i3ds
+
+#endif
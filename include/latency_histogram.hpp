@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __LATENCY_HISTOGRAM_HPP
+#define __LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace i3ds
+{
+
+// Lock-free histogram of durations in microseconds with power of two buckets.
+// Recording is wait-free, percentiles are resolved to the bucket upper bound.
+class LatencyHistogram
+{
+public:
+
+  static const int buckets = 32;
+
+  LatencyHistogram()
+  {
+    for (int i = 0; i < buckets; i++)
+      {
+        count_[i] = 0;
+      }
+  }
+
+  void record(int64_t us)
+  {
+    int i = 0;
+
+    while (us > 1 && i < buckets - 1)
+      {
+        us >>= 1;
+        i++;
+      }
+
+    count_[i].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Counts since last call, taken out of the histogram.
+  struct Snapshot
+  {
+    uint64_t count[buckets];
+    uint64_t total;
+
+    // Upper bound of the bucket holding the p-quantile, 0 if empty.
+    int64_t percentile(double p) const
+    {
+      if (total == 0)
+        {
+          return 0;
+        }
+
+      uint64_t seen = 0;
+
+      for (int i = 0; i < buckets; i++)
+        {
+          seen += count[i];
+
+          if (seen >= p * total)
+            {
+              return (int64_t) 2 << i;
+            }
+        }
+
+      return (int64_t) 2 << (buckets - 1);
+    }
+  };
+
+  Snapshot take()
+  {
+    Snapshot s;
+    s.total = 0;
+
+    for (int i = 0; i < buckets; i++)
+      {
+        s.count[i] = count_[i].exchange(0, std::memory_order_relaxed);
+        s.total += s.count[i];
+      }
+
+    return s;
+  }
+
+private:
+
+  std::atomic<uint64_t> count_[buckets];
+};
+
+} // namespace i3ds
+
+#endif
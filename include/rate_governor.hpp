@@ -0,0 +1,53 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RATE_GOVERNOR_HPP
+#define __RATE_GOVERNOR_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace i3ds
+{
+
+// Decimates a stream of samples to a target output period, independent of
+// the acquisition period. Times and periods are in microseconds.
+class RateGovernor
+{
+public:
+
+  RateGovernor();
+
+  // Output period of zero lets every sample through. The acquisition period
+  // is used as tolerance for jitter in sample arrival times.
+  void set_period(int64_t output_period, int64_t acquisition_period);
+
+  // Restart the output schedule, counters are kept.
+  void reset();
+
+  // Returns true if the sample arriving at time now shall be published.
+  bool admit(int64_t now);
+
+  uint64_t admitted() const {return admitted_;}
+  uint64_t dropped() const {return dropped_;}
+
+private:
+
+  int64_t period_;
+  int64_t slack_;
+  int64_t next_;
+
+  std::atomic<uint64_t> admitted_;
+  std::atomic<uint64_t> dropped_;
+};
+
+} // namespace i3ds
+
+#endif
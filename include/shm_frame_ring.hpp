@@ -0,0 +1,141 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SHM_FRAME_RING_HPP
+#define __SHM_FRAME_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace i3ds
+{
+
+// Ring of depth frames in POSIX shared memory, for consumers on the same
+// host. The node writes each frame once into a slot, readers map the ring
+// read-only and access the frames in place without decoding.
+//
+// Each slot is guarded by a sequence number, odd while the slot is written,
+// so a reader can check that a frame was not overwritten while read.
+// Readers are woken by a futex on the header.
+
+struct ShmRingHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  uint64_t slot_size;
+  uint64_t max_pixels;
+
+  std::atomic<uint64_t> latest; // Number of the last complete frame, 0 if none
+  std::atomic<int32_t> wakeup;  // Futex word, incremented for every frame
+};
+
+struct ShmSlotHeader
+{
+  std::atomic<uint64_t> seq;
+
+  uint64_t frame; // Frame number, starting at 1
+  uint64_t sequence; // Camera frame ID
+  uint64_t omitted;  // Camera frames the node did not write to the ring, total before this one
+  int64_t timestamp;
+
+  uint16_t offset_x;
+  uint16_t offset_y;
+  uint16_t size_x;
+  uint16_t size_y;
+
+  // Followed by double distances[max_pixels] and uint8_t validity[max_pixels],
+  // where validity 0 is a valid depth.
+};
+
+// Name of the shared memory ring of a node.
+std::string shm_ring_name(uint32_t node);
+
+class ShmFrameWriter
+{
+public:
+
+  // Creates or replaces the ring, throws std::runtime_error on failure.
+  ShmFrameWriter(const std::string &name, int slots, size_t max_pixels);
+  ~ShmFrameWriter();
+
+  // Start writing the next frame, returns the arrays to fill.
+  void Begin(double **distances, uint8_t **validity);
+
+  // Complete the frame begun and wake readers.
+  void Commit(uint64_t sequence, uint64_t omitted, int64_t timestamp,
+              uint16_t offset_x, uint16_t offset_y, uint16_t size_x, uint16_t size_y);
+
+  // Frames begun since the ring was created.
+  uint64_t Written() const {return frame_;}
+
+private:
+
+  ShmSlotHeader *slot(uint64_t frame);
+
+  std::string name_;
+  size_t size_;
+  ShmRingHeader *header_;
+  uint64_t frame_;
+};
+
+class ShmFrameReader
+{
+public:
+
+  // View of a frame in shared memory, valid until overwritten by the writer.
+  struct Frame
+  {
+    uint64_t frame;
+    uint64_t sequence;
+    uint64_t omitted;
+    int64_t timestamp;
+
+    uint16_t offset_x;
+    uint16_t offset_y;
+    uint16_t size_x;
+    uint16_t size_y;
+
+    const double *distances;
+    const uint8_t *validity;
+  };
+
+  // Maps the ring read-only, throws std::runtime_error on failure.
+  ShmFrameReader(const std::string &name);
+  ~ShmFrameReader();
+
+  // Waits for a frame newer than the last one read, returns false on timeout.
+  bool Wait(int timeout_ms);
+
+  // Get the latest complete frame, returns false if there is none.
+  bool Latest(Frame &frame);
+
+  // True if the frame has not been overwritten since it was taken. Check
+  // after reading the data to detect a reader lagging a full ring behind.
+  bool Valid(const Frame &frame) const;
+
+  // Frames written by the node that this reader has not seen.
+  uint64_t Skipped() const {return skipped_;}
+
+private:
+
+  const ShmSlotHeader *slot(uint64_t frame) const;
+
+  size_t size_;
+  const ShmRingHeader *header_;
+  uint64_t last_;
+  uint64_t skipped_;
+};
+
+} // namespace i3ds
+
+#endif
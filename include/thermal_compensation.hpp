@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __THERMAL_COMPENSATION_HPP
+#define __THERMAL_COMPENSATION_HPP
+
+#include <string>
+#include <vector>
+
+#include "tof_conversion.hpp"
+
+namespace i3ds
+{
+
+// Correction of depth drift with sensor temperature, from a calibration
+// table. The corrected distance is scale * distance + offset, interpolated
+// linearly in temperature between entries and held at the ends.
+class ThermalCompensation
+{
+public:
+
+  struct Entry
+  {
+    double temperature; // Celsius
+    double offset;      // Meters
+    double scale;
+  };
+
+  // Entries in increasing temperature, at least one.
+  explicit ThermalCompensation(const std::vector<Entry> &table);
+
+  // Correction at the temperature.
+  Entry at(double temperature) const;
+
+  // Scaling of raw depth with the correction at the temperature folded in.
+  DepthScale apply(const DepthScale &scale, double temperature) const;
+
+  int size() const {return (int) table_.size();}
+
+private:
+
+  const std::vector<Entry> table_;
+};
+
+// Reads a table with one "temperature offset scale" line per entry, in
+// increasing temperature, where lines starting with # are comments. Throws
+// std::runtime_error if the file can not be read or is invalid.
+std::vector<ThermalCompensation::Entry> read_thermal_table(const std::string &path);
+
+} // namespace i3ds
+
+#endif
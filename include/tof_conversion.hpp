@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_CONVERSION_HPP
+#define __TOF_CONVERSION_HPP
+
+#include <cstdint>
+
+namespace i3ds
+{
+
+// Scaling of raw depth to meters. Depth of 2**16 - 1 is max_depth, 0 is
+// min_depth, with depth limits in meters.
+struct DepthScale
+{
+  DepthScale(double min_depth, double max_depth)
+    : KA((max_depth - min_depth) / 65535.0), KB(min_depth) {}
+
+  double operator()(uint16_t depth) const {return KA * depth + KB;}
+
+  double KA;
+  double KB;
+};
+
+// A pixel has a valid depth if neither depth nor confidence is zero.
+inline bool valid_depth(uint16_t depth, uint16_t confidence)
+{
+  return depth != 0 && confidence != 0;
+}
+
+// As above, and the intensity must be at least min_intensity.
+inline bool valid_depth(uint16_t depth, uint16_t confidence, uint16_t intensity, uint16_t min_intensity)
+{
+  return depth != 0 && confidence != 0 && intensity >= min_intensity;
+}
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_NORMALS_HPP
+#define __TOF_NORMALS_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <i3ds/tof_camera_sensor.hpp>
+
+namespace i3ds
+{
+
+// Surface normals and planarity of a distance image, at every stride-th
+// pixel in both directions. Points are summed over a window of radius pixels
+// with integral images, so the cost per output does not depend on the window.
+// The normal is the eigenvector of the smallest eigenvalue of the window
+// covariance, oriented toward the camera, and planarity is one for a plane
+// and zero for points without structure. Only valid pixels are summed, and an
+// output is invalid if its center is invalid or less than half the window is
+// valid. Rows are split in bands, each with its own integral image, that are
+// processed in parallel.
+class SurfaceNormals
+{
+public:
+
+  // Output is nx, ny, nz and planarity scaled to int16, one plane each, so
+  // every channel can be sent as a mono image.
+  static const int channels = 4;
+  static const int scale = 32767;
+
+  // Pinhole model of the full sensor, field of view in degrees.
+  SurfaceNormals(double fov_x, double fov_y, int radius, int stride, int threads);
+  ~SurfaceNormals();
+
+  void compute(const ToFCamera::MeasurementTopic::Data &frame, int sensor_width, int sensor_height);
+
+  // Output size and region, the region is in sensor pixels divided by stride.
+  int width() const {return out_width_;}
+  int height() const {return out_height_;}
+  PlanarRegion region() const;
+
+  // Plane of a channel, and its size in bytes.
+  const int16_t *plane(int channel) const {return output_.data() + channel * out_width_ * out_height_;}
+  size_t plane_size() const {return out_width_ * out_height_ * sizeof(int16_t);}
+
+private:
+
+  // Sums of 1, x, y, z, xx, xy, xz, yy, yz, zz.
+  static const int sums = 10;
+
+  struct Band
+  {
+    int first; // Output rows.
+    int last;
+    std::vector<double> integral;
+  };
+
+  void update_rays(const PlanarRegion &region, int sensor_width, int sensor_height);
+  void run_band(Band &band);
+  void worker(int index);
+
+  const double fov_x_;
+  const double fov_y_;
+  const int radius_;
+  const int stride_;
+
+  PlanarRegion region_;
+  int sensor_width_;
+  int sensor_height_;
+  std::vector<float> rays_;
+
+  int out_width_;
+  int out_height_;
+  std::vector<int16_t> output_;
+
+  const ToFCamera::MeasurementTopic::Data *frame_;
+  std::vector<Band> bands_;
+
+  // Band workers, band zero is run by the caller.
+  std::mutex mutex_;
+  std::condition_variable start_cond_;
+  std::condition_variable done_cond_;
+  uint64_t generation_;
+  int pending_;
+  bool running_;
+  std::vector<std::thread> workers_;
+};
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,191 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_PIPELINE_HPP
+#define __TOF_PIPELINE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "tof_conversion.hpp"
+
+namespace i3ds
+{
+
+// Per-pixel processing of ToF frames, composed at compile time from stages.
+// The planes are processed one tile at a time, and every stage runs over the
+// tile before the next, so intermediate results stay in L1 cache and each
+// stage is a simple loop the compiler can vectorize.
+
+struct ToFPlanes
+{
+  const uint16_t *depth;
+  const uint16_t *confidence;
+  const uint16_t *intensity; // May be nullptr if no stage uses it.
+  int size;
+};
+
+struct ToFParameters
+{
+  ToFParameters(const DepthScale &scale) : scale(scale), min_intensity(0), min_valid(0.0), max_valid(0.0) {}
+
+  DepthScale scale;
+  uint16_t min_intensity;
+  double min_valid; // Meters
+  double max_valid; // Zero is no upper bound.
+};
+
+struct ToFTile
+{
+  static const int size = 1024;
+
+  const uint16_t *depth;
+  const uint16_t *confidence;
+  const uint16_t *intensity;
+  int count;
+
+  double distance[size];
+  uint8_t valid[size];
+};
+
+// Stages, each has a static apply(ToFTile &, const ToFParameters &).
+
+struct ScaleStage
+{
+  static void apply(ToFTile &t, const ToFParameters &p)
+  {
+    const double KA = p.scale.KA, KB = p.scale.KB;
+
+    for (int i = 0; i < t.count; i++)
+      {
+        t.distance[i] = KA * t.depth[i] + KB;
+      }
+  }
+};
+
+struct ConfidenceStage
+{
+  static void apply(ToFTile &t, const ToFParameters &)
+  {
+    for (int i = 0; i < t.count; i++)
+      {
+        t.valid[i] = (t.depth[i] != 0) & (t.confidence[i] != 0);
+      }
+  }
+};
+
+struct IntensityStage
+{
+  static void apply(ToFTile &t, const ToFParameters &p)
+  {
+    for (int i = 0; i < t.count; i++)
+      {
+        t.valid[i] &= t.intensity[i] >= p.min_intensity;
+      }
+  }
+};
+
+struct RangeStage
+{
+  static void apply(ToFTile &t, const ToFParameters &p)
+  {
+    const double min_valid = p.min_valid;
+    const double max_valid = p.max_valid > 0.0 ? p.max_valid : std::numeric_limits<double>::infinity();
+
+    for (int i = 0; i < t.count; i++)
+      {
+        t.valid[i] &= (t.distance[i] >= min_valid) & (t.distance[i] <= max_valid);
+      }
+  }
+};
+
+template<typename... Stages>
+struct ToFPipeline;
+
+template<>
+struct ToFPipeline<>
+{
+  static void apply(ToFTile &, const ToFParameters &) {}
+};
+
+template<typename Stage, typename... Rest>
+struct ToFPipeline<Stage, Rest...>
+{
+  static void apply(ToFTile &t, const ToFParameters &p)
+  {
+    Stage::apply(t, p);
+    ToFPipeline<Rest...>::apply(t, p);
+  }
+};
+
+// Runs the pipeline over the planes, writing distances and validity, where
+// Validity is the output type of the validity mask.
+template<typename Pipeline, typename Validity>
+void run_tof_pipeline(const ToFPlanes &planes, const ToFParameters &p, double *distances,
+                      Validity *validity, Validity valid, Validity invalid)
+{
+  ToFTile tile;
+
+  // Copied, std::min would bind a reference to the member without a definition.
+  const int tile_size = ToFTile::size;
+
+  for (int start = 0; start < planes.size; start += tile_size)
+    {
+      tile.count = std::min(tile_size, planes.size - start);
+      tile.depth = planes.depth + start;
+      tile.confidence = planes.confidence + start;
+      tile.intensity = planes.intensity ? planes.intensity + start : nullptr;
+
+      Pipeline::apply(tile, p);
+
+      memcpy(distances + start, tile.distance, tile.count * sizeof(double));
+
+      for (int i = 0; i < tile.count; i++)
+        {
+          validity[start + i] = tile.valid[i] ? valid : invalid;
+        }
+    }
+}
+
+template<typename Validity>
+using ToFKernel = void (*)(const ToFPlanes &, const ToFParameters &, double *, Validity *, Validity, Validity);
+
+// Prebuilt pipelines, selected at runtime by the stages enabled.
+template<typename Validity>
+ToFKernel<Validity> select_tof_kernel(bool intensity, bool range)
+{
+  typedef ToFPipeline<ScaleStage, ConfidenceStage> Base;
+  typedef ToFPipeline<ScaleStage, ConfidenceStage, IntensityStage> WithIntensity;
+  typedef ToFPipeline<ScaleStage, ConfidenceStage, RangeStage> WithRange;
+  typedef ToFPipeline<ScaleStage, ConfidenceStage, IntensityStage, RangeStage> WithBoth;
+
+  if (intensity && range)
+    {
+      return &run_tof_pipeline<WithBoth, Validity>;
+    }
+
+  if (intensity)
+    {
+      return &run_tof_pipeline<WithIntensity, Validity>;
+    }
+
+  if (range)
+    {
+      return &run_tof_pipeline<WithRange, Validity>;
+    }
+
+  return &run_tof_pipeline<Base, Validity>;
+}
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,26 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_PYRAMID_HPP
+#define __TOF_PYRAMID_HPP
+
+#include <i3ds/tof_camera_sensor.hpp>
+
+namespace i3ds
+{
+
+// Halves the resolution of a measurement, each output pixel is the mean of
+// the valid pixels in a 2x2 block, and invalid if the block has none.
+// Region offset and size are halved, attributes are copied.
+void pyramid_down(const ToFCamera::MeasurementTopic::Data &src, ToFCamera::MeasurementTopic::Data &dst);
+
+} // namespace i3ds
+
+#endif
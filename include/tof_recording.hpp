@@ -0,0 +1,89 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_RECORDING_HPP
+#define __TOF_RECORDING_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace i3ds
+{
+
+// Recorded raw frames. Each frame is a header followed by the depth and
+// confidence planes, and the intensity plane if flagged, as uint16 in host
+// byte order.
+static const char record_magic[8] = {'I', '3', 'D', 'S', 'T', 'O', 'F', '1'};
+
+static const uint32_t record_intensity = 1;
+
+struct ToFRecordHeader
+{
+  char magic[8];
+  uint32_t flags;
+  uint16_t width;
+  uint16_t height;
+  uint16_t offset_x;
+  uint16_t offset_y;
+  uint32_t reserved;
+  int64_t timestamp;  // Microseconds
+  int64_t min_depth;  // Millimeters, range of raw depth
+  int64_t max_depth;
+  uint64_t sequence;
+};
+
+struct ToFRecord
+{
+  ToFRecordHeader header;
+  std::vector<uint16_t> depth;
+  std::vector<uint16_t> confidence;
+  std::vector<uint16_t> intensity;
+};
+
+inline bool write_record(FILE *file, const ToFRecordHeader &header, const uint16_t *depth,
+                         const uint16_t *confidence, const uint16_t *intensity)
+{
+  const size_t size = (size_t) header.width * header.height;
+
+  ToFRecordHeader h = header;
+  memcpy(h.magic, record_magic, sizeof(record_magic));
+
+  return fwrite(&h, sizeof(h), 1, file) == 1 &&
+         fwrite(depth, sizeof(uint16_t), size, file) == size &&
+         fwrite(confidence, sizeof(uint16_t), size, file) == size &&
+         (!(h.flags & record_intensity) || (intensity && fwrite(intensity, sizeof(uint16_t), size, file) == size));
+}
+
+// Returns false at end of file or on a malformed record.
+inline bool read_record(FILE *file, ToFRecord &record)
+{
+  ToFRecordHeader &h = record.header;
+
+  if (fread(&h, sizeof(h), 1, file) != 1 || memcmp(h.magic, record_magic, sizeof(record_magic)) != 0)
+    {
+      return false;
+    }
+
+  const size_t size = (size_t) h.width * h.height;
+
+  record.depth.resize(size);
+  record.confidence.resize(size);
+  record.intensity.resize(h.flags & record_intensity ? size : 0);
+
+  return fread(record.depth.data(), sizeof(uint16_t), size, file) == size &&
+         fread(record.confidence.data(), sizeof(uint16_t), size, file) == size &&
+         fread(record.intensity.data(), sizeof(uint16_t), record.intensity.size(), file) == record.intensity.size();
+}
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,115 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_UNDISTORT_HPP
+#define __TOF_UNDISTORT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace i3ds
+{
+
+// Pinhole model with radial and tangential distortion of the full sensor,
+// with coefficients as in OpenCV.
+struct LensModel
+{
+  double fx, fy;
+  double cx, cy;
+  double k1, k2, k3;
+  double p1, p2;
+};
+
+// Reads a lens model from a file with one "name = value" line per
+// coefficient, distortion coefficients not given are zero. Throws
+// std::runtime_error if the file can not be read.
+LensModel read_lens_model(const std::string &path);
+
+enum UndistortMode
+{
+  undistort_none,
+  undistort_nearest,
+  undistort_bilinear
+};
+
+// Remaps the raw planes of a frame to an ideal pinhole camera with the same
+// focal length and center, so the distance of each pixel is along its ray.
+// Tables of source pixels with fixed-point weights are built per region.
+// Bilinear interpolation of depth and confidence uses only valid neighbours,
+// and the pixel is invalid unless half the weight is on valid neighbours.
+// Pixels that map outside the region are invalid.
+class Undistortion
+{
+public:
+
+  Undistortion(const LensModel &lens, UndistortMode mode, int max_pixels);
+
+  // Builds the table for a region before it is used, may be called from
+  // another thread than apply.
+  void prepare(int offset_x, int offset_y, int width, int height);
+
+  // Remaps the planes, which are changed to point to internal buffers valid
+  // until the next call. Intensity may be nullptr.
+  void apply(const uint16_t *&depth, const uint16_t *&confidence, const uint16_t *&intensity,
+             int width, int height, int offset_x, int offset_y);
+
+private:
+
+  // Weights are in 1/128 pixel, the four sum to 2**14.
+  static const int frac_bits = 7;
+  static const int weight_bits = 2 * frac_bits;
+
+  struct Entry
+  {
+    int32_t source; // Top-left neighbour, or -1 if outside.
+    uint8_t ax;
+    uint8_t ay;
+  };
+
+  struct Table
+  {
+    int offset_x, offset_y, width, height;
+    std::vector<Entry> entries;
+
+    bool matches(int ox, int oy, int w, int h) const
+    {
+      return offset_x == ox && offset_y == oy && width == w && height == h;
+    }
+  };
+
+  typedef std::shared_ptr<const Table> TablePtr;
+
+  TablePtr build(int offset_x, int offset_y, int width, int height) const;
+
+  void remap_nearest(const Table &table, const uint16_t *depth, const uint16_t *confidence,
+                     const uint16_t *intensity);
+  void remap_bilinear(const Table &table, const uint16_t *depth, const uint16_t *confidence,
+                      const uint16_t *intensity);
+
+  const LensModel lens_;
+  const UndistortMode mode_;
+
+  // Used by apply only.
+  TablePtr current_;
+
+  std::mutex mutex_;
+  TablePtr prepared_;
+
+  std::vector<uint16_t> depth_;
+  std::vector<uint16_t> confidence_;
+  std::vector<uint16_t> intensity_;
+};
+
+} // namespace i3ds
+
+#endif
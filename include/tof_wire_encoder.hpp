@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TOF_WIRE_ENCODER_HPP
+#define __TOF_WIRE_ENCODER_HPP
+
+#include <i3ds/tof_camera_sensor.hpp>
+#include <i3ds/time.hpp>
+
+#include <vector>
+
+#include "tof_conversion.hpp"
+
+namespace i3ds
+{
+
+// Encodes ToF measurements straight from the raw depth and confidence
+// planes into the wire format of ToFCamera::MeasurementTopic, without
+// filling a measurement struct first. The output buffer is reused.
+//
+// The encoder issues the same PER primitives as the generated codec. Use
+// Matches() on a frame before trusting it, since the layout is fixed here.
+// Only sizes and ranges are checked against the ASN.1 definition, when built.
+class ToFWireEncoder
+{
+public:
+
+  ToFWireEncoder();
+
+  void Encode(const uint16_t *depth, const uint16_t *confidence, const PlanarRegion &region,
+              const DepthScale &scale, Timepoint timestamp);
+
+  // Encodes the frame with the generic codec, returns true if the output is
+  // identical to that of the last call to Encode().
+  bool Matches(const ToFCamera::MeasurementTopic::Data &frame);
+
+  const byte *data() const {return buffer_.data();}
+  size_t size() const {return size_;}
+
+private:
+
+  std::vector<byte> buffer_;
+  std::vector<byte> reference_;
+  size_t size_;
+};
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,108 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TRACE_RING_HPP
+#define __TRACE_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include <time.h>
+
+namespace i3ds
+{
+
+// Stages recorded in the trace, stable since they are stored in dumps.
+enum TraceStage : uint32_t
+{
+  trace_grab_ok = 1,
+  trace_grab_timeout,
+  trace_grab_failed,
+  trace_grab_disconnected,
+  trace_region_commit,
+  trace_sample_start,
+  trace_sample_skipped,
+  trace_sample_converted,
+  trace_sample_posted,
+  trace_sample_published,
+  trace_grab_gap,
+  trace_stage_end
+};
+
+const char *trace_stage_name(uint32_t stage);
+
+// Record as stored in dump files, after the header.
+struct TraceRecord
+{
+  uint64_t seq;
+  uint64_t time;  // Nanoseconds, monotonic clock
+  uint64_t frame;
+  uint32_t stage;
+  uint32_t arg;
+};
+
+// Dump files start with this magic and the number of records.
+static const char trace_magic[8] = {'I', '3', 'D', 'S', 'T', 'R', 'C', '1'};
+
+// Fixed size ring of binary events, recording is lock-free and wait-free
+// for any number of threads. The oldest events are overwritten.
+class TraceRing
+{
+public:
+
+  static const size_t size = 1 << 16;
+
+  // Process wide ring.
+  static TraceRing& Global();
+
+  TraceRing();
+
+  void Record(TraceStage stage, uint64_t frame, uint32_t arg = 0)
+  {
+    const uint64_t index = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = slots_[index & (size - 1)];
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Sequence is zero while the slot is written, readers skip it.
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.time.store(now.tv_sec * 1000000000ULL + now.tv_nsec, std::memory_order_relaxed);
+    slot.frame.store(frame, std::memory_order_relaxed);
+    slot.data.store(((uint64_t) stage << 32) | arg, std::memory_order_relaxed);
+
+    slot.seq.store(index + 1, std::memory_order_release);
+  }
+
+  // Writes the events in the ring to file in sequence order, returns the
+  // number of events written or -1 if the file could not be written.
+  long Dump(const std::string &path) const;
+
+private:
+
+  struct Slot
+  {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> time;
+    std::atomic<uint64_t> frame;
+    std::atomic<uint64_t> data;
+  };
+
+  std::atomic<uint64_t> head_;
+  Slot slots_[size];
+};
+
+} // namespace i3ds
+
+#endif
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TRIGGER_TIMELINE_HPP
+#define __TRIGGER_TIMELINE_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "latency_histogram.hpp"
+
+namespace i3ds
+{
+
+// Reconstructs the trigger pulses of a generator from its period and channel
+// offset, and measures the latency from pulse to frame arrival and to publish.
+// Times are in microseconds, frames must arrive within one period of their
+// pulse. The generator epoch is anchored when the channels are enabled and
+// moved back if a frame arrives before the first pulse.
+class TriggerTimeline
+{
+public:
+
+  TriggerTimeline();
+
+  void start(int64_t epoch, int64_t period, int64_t offset);
+  void stop();
+
+  bool running() const {return period_ > 0;}
+
+  // Frame arrived at time t, returns the latency from its trigger pulse.
+  int64_t arrival(int64_t t);
+
+  // Frame that arrived at time grabbed was published at time sent.
+  void published(int64_t grabbed, int64_t sent);
+
+  // Distributions and jitter since last call, missed pulses since start.
+  struct Snapshot
+  {
+    LatencyHistogram::Snapshot grab;
+    LatencyHistogram::Snapshot publish;
+    int64_t jitter;
+    uint64_t missed;
+  };
+
+  Snapshot take();
+
+  uint64_t missed() const {return missed_;}
+
+private:
+
+  int64_t pulse(int64_t t, int64_t *index) const;
+
+  std::atomic<int64_t> epoch_;
+  std::atomic<int64_t> period_;
+  int64_t offset_;
+
+  int64_t last_index_;
+
+  LatencyHistogram grab_;
+  LatencyHistogram publish_;
+
+  std::atomic<int64_t> min_latency_;
+  std::atomic<int64_t> max_latency_;
+  std::atomic<uint64_t> missed_;
+};
+
+} // namespace i3ds
+
+#endif
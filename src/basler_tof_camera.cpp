@@ -12,10 +12,20 @@
 #include <sstream>
 #include <iomanip>
 #include <memory>
+#include <chrono>
+#include <cmath>
 
 #include <i3ds/time.hpp>
 
 #include "basler_tof_camera.hpp"
+#include "tof_pyramid.hpp"
+#include "trace_ring.hpp"
+#include "tof_conversion.hpp"
+#include "tof_pipeline.hpp"
+
+#include <cstring>
+
+#include <i3ds/message.hpp>
 
 #define BOOST_LOG_DYN_LINK
 
@@ -28,6 +38,12 @@ i3ds::BaslerToFCamera::BaslerToFCamera(Context::Ptr context, NodeID node, Parame
   : ToFCamera (node ),
     param_ (param ),
     publisher_ (context, node ),
+    encoder_verified_(false),
+    batch_running_(false),
+    frame_count_(0),
+    frames_published_(0),
+    frames_unchanged_(0),
+    telemetry_running_(false),
     trigger_(trigger)
 {
   using namespace std::placeholders;
@@ -36,6 +52,94 @@ i3ds::BaslerToFCamera::BaslerToFCamera(Context::Ptr context, NodeID node, Parame
 
   camera_ = nullptr;
 
+  frame_.reset(new ToFCamera::MeasurementTopic::Data);
+  ToFCamera::MeasurementTopic::Codec::Initialize (*frame_);
+
+  if (param_.batch_frames > 1)
+    {
+      BOOST_LOG_TRIVIAL (info) << "Batches of " << param_.batch_frames << " frames on node " << param_.batch_node;
+
+      batcher_.reset(new FrameBatcher(param_.batch_node, param_.batch_frames, param_.batch_latency));
+      batch_publisher_.reset(new Publisher(context, param_.batch_node));
+    }
+
+  if (param_.latest_only && !param_.shm_only && !batcher_)
+    {
+      mailbox_.reset(new FrameMailbox<ToFCamera::MeasurementTopic::Data>(&ToFCamera::MeasurementTopic::Codec::Initialize));
+    }
+
+  for (const StreamParameters &p : param_.streams)
+    {
+      BOOST_LOG_TRIVIAL (info) << "Stream on node " << p.node << " level " << p.level << " divider " << p.divider;
+
+      streams_.push_back({p, std::unique_ptr<Publisher>(new Publisher(context, p.node))});
+
+      while ((int) levels_.size() < p.level)
+        {
+          levels_.emplace_back(new ToFCamera::MeasurementTopic::Data);
+          ToFCamera::MeasurementTopic::Codec::Initialize (*levels_.back());
+        }
+    }
+
+  if (param_.direct_encoding)
+    {
+      encoder_.reset(new ToFWireEncoder);
+    }
+
+  if (param_.intensity)
+    {
+      intensity_publisher_.reset(new Publisher(context, param_.intensity_node));
+      Camera::FrameTopic::Codec::Initialize (intensity_frame_);
+    }
+
+  if (param_.normals_stride > 0)
+    {
+      BOOST_LOG_TRIVIAL (info) << "Surface normals at stride " << param_.normals_stride << " on node " << param_.normals_node;
+
+      normals_.reset(new SurfaceNormals(param_.fov_x, param_.fov_y, param_.normals_radius,
+                                        param_.normals_stride, param_.normals_threads));
+      normals_publisher_.reset(new Publisher(context, param_.normals_node));
+      Camera::FrameTopic::Codec::Initialize (normals_frame_);
+    }
+
+  const size_t max_pixels = sizeof(frame_->distances.arr) / sizeof(frame_->distances.arr[0]);
+
+  if (param_.change_threshold > 0.0)
+    {
+      change_gate_.reset(new ChangeGate(max_pixels));
+    }
+
+  if (param_.shm_slots > 0)
+    {
+      shm_.reset(new ShmFrameWriter(shm_ring_name(node), param_.shm_slots, max_pixels));
+
+      BOOST_LOG_TRIVIAL (info) << "Shared memory ring " << shm_ring_name(node) << " with " << param_.shm_slots << " slots";
+    }
+
+  if (!param_.thermal_table.empty())
+    {
+      thermal_.reset(new ThermalCompensation(param_.thermal_table));
+
+      BOOST_LOG_TRIVIAL (info) << "Thermal compensation with " << thermal_->size() << " entries";
+    }
+
+  if (param_.history_budget > 0)
+    {
+      history_.reset(new FrameHistory((size_t) param_.history_budget << 20, max_pixels));
+
+      BOOST_LOG_TRIVIAL (info) << "Frame history of " << history_->Slots() << " frames";
+    }
+
+  if (param_.undistort != undistort_none)
+    {
+      undistortion_.reset(new Undistortion(param_.lens, param_.undistort, max_pixels));
+    }
+
+  if (param_.telemetry_period > 0)
+    {
+      telemetry_publisher_.reset(new Publisher(context, param_.telemetry_node));
+    }
+
   if (trigger_)
     {
       // Only wait 100 ms for trigger service.
@@ -45,6 +149,17 @@ i3ds::BaslerToFCamera::BaslerToFCamera(Context::Ptr context, NodeID node, Parame
 
 i3ds::BaslerToFCamera::~BaslerToFCamera()
 {
+  stop_telemetry();
+
+  // Queued commands use the camera and housekeeping, run them while both exist.
+  if (executor_)
+    {
+      executor_->Drain();
+      executor_.reset();
+    }
+
+  housekeeping_.reset();
+
   if (camera_)
     {
       delete camera_;
@@ -65,93 +180,59 @@ i3ds::BaslerToFCamera::set_error_state(const std::string &error_message, const b
 }
 
 
-/// Realtime check of region_enabled. Avoiding updating an variable all the time. Safer for consistencity
+/// Region as last set, read without blocking on the camera.
 bool
 i3ds::BaslerToFCamera::region_enabled()
 {
-  bool retval = false;
-  try
-    {
-      if ((camera_->Width() == camera_->SensorWidth()) &&
-          (camera_->Height() == camera_->SensorHeight()) &&
-          (camera_->OffsetX() == 0) &&
-          (camera_->OffsetY() == 0)
-         )
-        {
-          retval = false;
-        }
-      else
-        {
-          retval = true;
-        }
-    }
-  catch (const GenICam::GenericException &e)
-    {
-      BOOST_LOG_TRIVIAL (error) << "region() problem communicating with hw";
-      set_error_state("Error communicating with ToF in region_enabled(): " + std::string (e.what()));
-    }
-  return retval;
+  const BaslerToFWrapper::Region r = camera_->GetRegion();
+
+  return !(r.width == sensor_width_ && r.height == sensor_height_ && r.offset_x == 0 && r.offset_y == 0);
 }
 
 PlanarRegion
 i3ds::BaslerToFCamera::region()
 {
+  const BaslerToFWrapper::Region r = camera_->GetRegion();
+
   PlanarRegion region;
-  BOOST_LOG_TRIVIAL (info) << "Check region";
-  try
-    {
-      region.offset_x = (T_UInt16) camera_->OffsetX();
-      region.offset_y = (T_UInt16) camera_->OffsetY();
-      region.size_x = (T_UInt16) camera_->Width();
-      region.size_y = (T_UInt16) camera_->Height();
-    }
-  catch (const GenICam::GenericException &e)
-    {
-      BOOST_LOG_TRIVIAL (error) << "region() problem communicating with hw";
-      set_error_state("Error communicating with ToF in region(): " + std::string (e.what()));
-    }
+
+  region.offset_x = (T_UInt16) r.offset_x;
+  region.offset_y = (T_UInt16) r.offset_y;
+  region.size_x = (T_UInt16) r.width;
+  region.size_y = (T_UInt16) r.height;
+
   return region;
 }
 
 double
 i3ds::BaslerToFCamera::range_min_depth() const
 {
-  return 1.0e-3 * (double) camera_->getMinDepth();
+  return 1.0e-3 * (double) housekeeping_->GetStatus()->min_depth;
 }
 
 double
 i3ds::BaslerToFCamera::range_max_depth() const
 {
-  return 1.0e-3 * (double) camera_->getMaxDepth();
+  return 1.0e-3 * (double) housekeeping_->GetStatus()->max_depth;
 }
 
 double
 i3ds::BaslerToFCamera::range_min_depth_lower_limit() const
 {
-  return 1.0e-3 * (double) camera_->getMinDepth_lower_limit();
+  return 1.0e-3 * (double) housekeeping_->GetStatus()->min_depth_lower_limit;
 }
 
 double
 i3ds::BaslerToFCamera::range_max_depth_upper_limit() const
 {
-  return 1.0e-3 * (double) camera_->getMaxDepth_upper_limit();
+  return 1.0e-3 * (double) housekeeping_->GetStatus()->max_depth_upper_limit;
 }
 
-/// Sensorboard Temperature converted to Kelvin
+/// Sensorboard Temperature converted to Kelvin, as last polled by housekeeping
 double
 i3ds::BaslerToFCamera::temperature ()
 {
-  double retval = 0.0;
-  try
-    {
-      retval = camera_->getTemperature () + 273.15;
-    }
-  catch (const GenICam::GenericException &e)
-    {
-      BOOST_LOG_TRIVIAL (error) << "temperature() problem communicating with hw";
-      set_error_state("Error communicating with ToF in temperature(): " + std::string (e.what()));
-    }
-  return retval;
+  return housekeeping_->GetStatus()->temperature + 273.15;
 }
 
 void
@@ -163,21 +244,39 @@ i3ds::BaslerToFCamera::do_activate()
 
   try
     {
-      auto operation = std::bind (&i3ds::BaslerToFCamera::send_sample, this, _1, _2, _3, _4);
+      auto operation = std::bind (&i3ds::BaslerToFCamera::send_sample, this, _1, _2, _3, _4, _5, _6, _7);
 
       auto error_signaler = std::bind (&i3ds::BaslerToFCamera::set_error_state, this, _1, _2);
 
-      camera_ = new BaslerToFWrapper (param_.camera_name, operation, error_signaler);
+      camera_ = new BaslerToFWrapper (param_.camera_name, param_.intensity, operation, error_signaler);
+
+      sensor_width_ = camera_->SensorWidth();
+      sensor_height_ = camera_->SensorHeight();
+
       BOOST_LOG_TRIVIAL (info) << "region_enabled() " << region_enabled();
       set_device_name (camera_->GetDeviceModelName());
 
+      housekeeping_.reset(new BaslerToFHousekeeping(*camera_, param_.temperature_period, param_.limits_period));
+      housekeeping_->Start();
+
+      // Device failures in commands go to failure state, as in sampling.
+      executor_.reset(new DeviceExecutor([this](const std::string & error_message)
+      {
+        set_error_state(error_message, true);
+      }));
+
       if (trigger_)
         {
           set_trigger(param_.camera_output, param_.camera_offset);
         }
+
+      start_telemetry();
     }
   catch (const GenICam::GenericException &e)
     {
+      executor_.reset();
+      housekeeping_.reset();
+
       if (camera_)
         {
           BOOST_LOG_TRIVIAL (info) << "Camera deinit";
@@ -196,9 +295,28 @@ i3ds::BaslerToFCamera::do_start()
 
   try
     {
+      // Commands submitted in standby are in effect before sampling.
+      executor_->Drain();
+
+      // Table for the region is built before the first frame.
+      if (undistortion_)
+        {
+          const PlanarRegion r = region();
+          undistortion_->prepare(r.offset_x, r.offset_y, r.size_x, r.size_y);
+        }
+
       min_depth_ = range_min_depth();
       max_depth_ = range_max_depth();
 
+      if (param_.auto_range)
+        {
+          BaslerToFHousekeeping::StatusPtr status = housekeeping_->GetStatus();
+
+          depth_range_ = {status->min_depth, status->max_depth};
+          range_adapter_.reset(new DepthRangeAdapter(status->min_depth_lower_limit, status->max_depth_upper_limit,
+                                                     param_.auto_range_period));
+        }
+
       if (param_.external_trigger)
         {
           camera_->setTriggerMode (true);
@@ -206,6 +324,9 @@ i3ds::BaslerToFCamera::do_start()
           BOOST_LOG_TRIVIAL(info) << "Generator trigger_source:period " << param_.trigger_source << ":" << period();
           trigger_->set_generator(param_.trigger_source, period());
           trigger_->enable_channels(trigger_outputs_);
+
+          // Pulses are assumed to start when the channels are enabled.
+          trigger_timeline_.start(get_timestamp(), period(), param_.camera_offset);
         }
       else
         {
@@ -213,6 +334,29 @@ i3ds::BaslerToFCamera::do_start()
           camera_->setTriggerRate (1.0e6 / period());
         }
 
+      governor_.set_period(param_.publish_period, period());
+
+      // Direct encoding is checked against the codec on the first frame.
+      encoder_verified_ = false;
+
+      // First frame after start is always published in full.
+      if (change_gate_)
+        {
+          change_gate_->configure(param_.change_fraction, 1000 * (int64_t) param_.keyframe_period);
+        }
+
+      if (mailbox_)
+        {
+          mailbox_->open();
+          sender_ = std::thread(&i3ds::BaslerToFCamera::send_loop, this);
+        }
+
+      if (batcher_)
+        {
+          batch_running_ = true;
+          sender_ = std::thread(&i3ds::BaslerToFCamera::batch_loop, this);
+        }
+
       camera_->Start();
     }
   catch (const GenICam::GenericException &e)
@@ -228,6 +372,28 @@ i3ds::BaslerToFCamera::do_stop()
   BOOST_LOG_TRIVIAL (info) << "do_stop()";
 
   camera_->Stop();
+
+  stop_sender();
+
+  BOOST_LOG_TRIVIAL (info) << "Frames published " << frames_published_
+                           << ", decimated " << frames_decimated()
+                           << ", discarded " << frames_discarded()
+                           << ", unchanged " << frames_unchanged();
+
+  BOOST_LOG_TRIVIAL (info) << "Frames lost by driver " << camera_->DriverGaps()
+                           << ", by grab " << camera_->GrabDrops()
+                           << ", replaced before publish " << frames_discarded();
+
+  if (trigger_timeline_.running())
+    {
+      trigger_timeline_.stop();
+
+      const TriggerTimeline::Snapshot t = trigger_timeline_.take();
+
+      BOOST_LOG_TRIVIAL (info) << "Trigger to frame p50/p99 " << t.grab.percentile(0.50) << "/" << t.grab.percentile(0.99)
+                               << " us, to publish p50/p99 " << t.publish.percentile(0.50) << "/" << t.publish.percentile(0.99)
+                               << " us, jitter " << t.jitter << " us, missed " << t.missed;
+    }
 }
 
 void
@@ -235,10 +401,23 @@ i3ds::BaslerToFCamera::do_deactivate()
 {
   BOOST_LOG_TRIVIAL (info) << "do_deactivate()";
 
+  stop_telemetry();
+
+  // Queued commands use the camera and housekeeping, run them while both exist.
+  if (executor_)
+    {
+      executor_->Drain();
+      executor_.reset();
+    }
+
+  housekeeping_.reset();
+
   // Only to do a join on sampling thread in case of failure to avoid exception
   if (is_failure())
     {
       camera_->Stop();
+
+      stop_sender();
     }
 
   delete camera_;
@@ -248,33 +427,27 @@ i3ds::BaslerToFCamera::do_deactivate()
 bool
 i3ds::BaslerToFCamera::is_sampling_supported(SampleCommand sample)
 {
-  bool retval = false;
-
-  try
+  if (param_.external_trigger)
     {
-      if (param_.external_trigger)
-        {
-          throw i3ds::CommandError (error_other, "Period is not relevant in for external trigger.");
-        }
+      throw i3ds::CommandError (error_other, "Period is not relevant in for external trigger.");
+    }
 
-      const float rate = 1.0e6 / sample.period;
-      const float max_rate = camera_->maxTriggerRate();
-      const float min_rate = camera_->minTriggerRate();
+  // Limits as last polled by housekeeping, the camera is not read here.
+  // Queued region commands change the limits, they are run first.
+  executor_->Drain();
 
-      BOOST_LOG_TRIVIAL (trace) << "rate() " << rate;
-      BOOST_LOG_TRIVIAL (trace) << "max_rate " << max_rate;
-      BOOST_LOG_TRIVIAL (trace) << "min_rate " << min_rate;
-      BOOST_LOG_TRIVIAL (trace) << "(min_rate <= rate && rate <= max_rate) " << ((min_rate <= rate) && (rate <= max_rate));
+  BaslerToFHousekeeping::StatusPtr status = housekeeping_->GetStatus();
 
-      retval = min_rate <= rate && rate <= max_rate;
-    }
-  catch (const GenICam::GenericException &e)
-    {
-      BOOST_LOG_TRIVIAL (error) << "is_sampling_supported() problem communicating with hw";
-      set_error_state("Error communicating with ToF in is_sampling_supported(): " + std::string (e.what()));
-    }
+  const float rate = 1.0e6 / sample.period;
+  const float max_rate = status->max_trigger_rate;
+  const float min_rate = status->min_trigger_rate;
 
-  return retval;
+  BOOST_LOG_TRIVIAL (trace) << "rate() " << rate;
+  BOOST_LOG_TRIVIAL (trace) << "max_rate " << max_rate;
+  BOOST_LOG_TRIVIAL (trace) << "min_rate " << min_rate;
+  BOOST_LOG_TRIVIAL (trace) << "(min_rate <= rate && rate <= max_rate) " << ((min_rate <= rate) && (rate <= max_rate));
+
+  return min_rate <= rate && rate <= max_rate;
 }
 
 void
@@ -282,116 +455,101 @@ i3ds::BaslerToFCamera::handle_region(RegionService::Data &command)
 {
   BOOST_LOG_TRIVIAL (info) << "handle_region()";
 
-  try
+  // Region may be changed while sampling, it is committed between frames.
+  check_active();
+
+  BaslerToFWrapper::Region region = {0, 0, sensor_width_, sensor_height_};
+
+  if (command.request.enable)
     {
-      check_standby();
+      const PlanarRegion &r = command.request.region;
 
-      if (command.request.enable)
+      // Parameter checks
+      if ((r.size_x % 2) || (r.size_y % 2) || (r.offset_x % 2) || (r.offset_y % 2))
         {
-          PlanarRegion region = command.request.region;
-
-          // Parameter checks
-          if ((region.size_x % 2) || (region.size_y % 2) || (region.offset_x % 2) || (region.offset_y % 2))
-            {
-              throw i3ds::CommandError (error_value, "Region sizes and offsets have to be a even number.");
-            }
-
-          if ((region.size_x == 0) || (region.size_y == 0))
-            {
-              throw i3ds::CommandError (error_value, "Region size (width or height) can not be zero");
-            }
-
-          if ((region.size_x + region.offset_x) > ((unsigned) camera_->SensorWidth()))
-            {
-              throw i3ds::CommandError (error_value,
-                                        "Impossible condition: (Region width + offset_x) > (Maximum width of sensor) => " +
-                                        std::to_string ((region.size_x + region.offset_x)) +
-                                        " > " +
-                                        std::to_string (camera_->SensorWidth()));
-            }
-
-          if ((region.size_y + region.offset_y) > ((unsigned) camera_->SensorHeight()))
-            {
-              throw i3ds::CommandError (error_value,
-                                        "Imposible condition (Region height + offset_y) > (Maximum height of sensor) => " +
-                                        std::to_string ((region.size_y + region.offset_y)) +
-                                        " > " +
-                                        std::to_string (camera_->SensorHeight()));
-            }
-
-          // Decrease first, increase afterwards
-          if (region.size_x > ((unsigned) camera_->Width()))
-            {
-              camera_->setOffsetX (region.offset_x);
-              camera_->setWidth (region.size_x);
-            }
-          else
-            {
-              camera_->setWidth (region.size_x);
-              camera_->setOffsetX (region.offset_x);
-            }
-
-          if (region.size_y > ((unsigned) camera_->Height()))
-            {
-              camera_->setOffsetY (region.offset_y);
-              camera_->setHeight (region.size_y);
-            }
-          else
-            {
-              camera_->setHeight (region.size_y);
-              camera_->setOffsetX (region.offset_y);
-            }
+          throw i3ds::CommandError (error_value, "Region sizes and offsets have to be a even number.");
         }
-      else
+
+      if ((r.size_x == 0) || (r.size_y == 0))
         {
-          camera_->setOffsetX (0);
-          camera_->setOffsetY (0);
-          camera_->setWidth (camera_->SensorWidth());
-          camera_->setHeight (camera_->SensorHeight());
+          throw i3ds::CommandError (error_value, "Region size (width or height) can not be zero");
+        }
+
+      if ((r.size_x + r.offset_x) > sensor_width_)
+        {
+          throw i3ds::CommandError (error_value,
+                                    "Impossible condition: (Region width + offset_x) > (Maximum width of sensor) => " +
+                                    std::to_string ((r.size_x + r.offset_x)) +
+                                    " > " +
+                                    std::to_string (sensor_width_));
+        }
+
+      if ((r.size_y + r.offset_y) > sensor_height_)
+        {
+          throw i3ds::CommandError (error_value,
+                                    "Imposible condition (Region height + offset_y) > (Maximum height of sensor) => " +
+                                    std::to_string ((r.size_y + r.offset_y)) +
+                                    " > " +
+                                    std::to_string (sensor_height_));
         }
-    }
-  catch (const GenICam::GenericException &e)
-    {
-      BOOST_LOG_TRIVIAL (error) << "handle_region() problem communicating with hw";
 
-      set_error_state("Error communicating with ToF in handle_region(): " + std::string (e.what()));
+      region = {r.offset_x, r.offset_y, r.size_x, r.size_y};
     }
+
+  // Written to the camera off the server thread, device errors go to failure.
+  executor_->Submit("region", [this, region]()
+  {
+    // Table is ready when the region is committed between frames.
+    if (undistortion_)
+      {
+        undistortion_->prepare(region.offset_x, region.offset_y, region.width, region.height);
+      }
+
+    camera_->setRegion (region);
+
+    // Rate limits depend on the region. In standby the region is written at
+    // once, so these are the limits of the new region.
+    housekeeping_->UpdateTriggerRate (camera_->minTriggerRate(), camera_->maxTriggerRate());
+  });
 }
 
 void
 i3ds::BaslerToFCamera::handle_range(RangeService::Data &command)
 {
   BOOST_LOG_TRIVIAL (info) << "handle_range()";
-  try
-    {
-      check_standby();
 
-      // Check input parameters
-      if (command.request.min_depth < range_min_depth_lower_limit())
-        {
-          throw i3ds::CommandError (error_value,
-                                    "Minimum depth must be greater than " + std::to_string (range_min_depth_lower_limit()) + "[m]");
-        }
+  check_standby();
 
-      if (command.request.max_depth > range_max_depth_upper_limit())
-        {
-          throw i3ds::CommandError (error_value,
-                                    "Maximum depth must be less than " + std::to_string (range_max_depth_upper_limit()) + "[m]");
-        }
-
-      if (command.request.min_depth > command.request.max_depth)
-        {
-          throw i3ds::CommandError (error_value, "Maximum depth must be larger than minimum depth");
-        }
+  // Check input parameters
+  if (command.request.min_depth < range_min_depth_lower_limit())
+    {
+      throw i3ds::CommandError (error_value,
+                                "Minimum depth must be greater than " + std::to_string (range_min_depth_lower_limit()) + "[m]");
+    }
 
-      camera_->setMinDepth ((int64_t) (command.request.min_depth * 1000));
-      camera_->setMaxDepth ((int64_t) (command.request.max_depth * 1000));
+  if (command.request.max_depth > range_max_depth_upper_limit())
+    {
+      throw i3ds::CommandError (error_value,
+                                "Maximum depth must be less than " + std::to_string (range_max_depth_upper_limit()) + "[m]");
     }
-  catch (const GenICam::GenericException &e)
+
+  if (command.request.min_depth > command.request.max_depth)
     {
-      BOOST_LOG_TRIVIAL (error) << "handle_range() problem communicating with hw";
-      set_error_state("Error communicating with ToF in handle_range(): " + std::string (e.what()));
+      throw i3ds::CommandError (error_value, "Maximum depth must be larger than minimum depth");
     }
+
+  const int64_t min_depth = (int64_t) (command.request.min_depth * 1000);
+  const int64_t max_depth = (int64_t) (command.request.max_depth * 1000);
+
+  // Reported at once, and again when written, in case a poll read the
+  // camera in between.
+  housekeeping_->UpdateDepth (min_depth, max_depth);
+
+  executor_->Submit("range", [this, min_depth, max_depth]()
+  {
+    camera_->setDepthRange ({min_depth, max_depth});
+    housekeeping_->UpdateDepth (min_depth, max_depth);
+  });
 }
 
 void
@@ -412,42 +570,696 @@ i3ds::BaslerToFCamera::clear_trigger(TriggerOutput channel)
 }
 
 bool
-i3ds::BaslerToFCamera::send_sample(const uint16_t *depth, const uint16_t *confidence, int width, int height)
+i3ds::BaslerToFCamera::send_sample(const uint16_t *depth, const uint16_t *confidence, const uint16_t *intensity,
+                                   int width, int height, int offset_x, int offset_y)
 {
-  BOOST_LOG_TRIVIAL (trace) << "BaslerToFCamera::send_sample()";
-  BOOST_LOG_TRIVIAL (trace) << "ProcessingMode " << camera_->getEnum ("ProcessingMode");
+  TraceRing &trace = TraceRing::Global();
+
+  trace.Record(trace_sample_start, frame_count_);
+
+  const auto start = std::chrono::steady_clock::now();
+  const Timepoint now = get_timestamp();
+
+  if (range_adapter_)
+    {
+      update_range(depth, confidence, width * height);
+    }
+
+  // Correction for the last polled temperature is folded into the scaling,
+  // so it adds nothing per pixel.
+  const DepthScale scale = thermal_
+                           ? thermal_->apply(DepthScale(min_depth_, max_depth_), housekeeping_->GetStatus()->temperature)
+                           : DepthScale(min_depth_, max_depth_);
+
+  if (history_)
+    {
+      ToFRecordHeader record = {};
+
+      record.width = (uint16_t) width;
+      record.height = (uint16_t) height;
+      record.offset_x = (uint16_t) offset_x;
+      record.offset_y = (uint16_t) offset_y;
+      record.timestamp = now;
+      record.min_depth = std::llround(1000.0 * min_depth_);
+      record.max_depth = std::llround(1000.0 * max_depth_);
+      record.sequence = camera_->FrameId();
+
+      history_->Store(record, depth, confidence);
+    }
+
+  if (trigger_timeline_.running())
+    {
+      trigger_timeline_.arrival(now);
+    }
+
+  bool publish = governor_.admit(now);
+  bool crop = false;
+
+  // All outputs are from the remapped planes.
+  if (undistortion_ && (publish || !streams_.empty()))
+    {
+      undistortion_->apply(depth, confidence, intensity, width, height, offset_x, offset_y);
+    }
+  ChangeGate::Decision change;
+
+  // Without a depth range raw depth has no scale, every frame is published
+  // and the reference is taken again after.
+  if (publish && change_gate_ && !(scale.KA > 0.0))
+    {
+      change_gate_->reset();
+    }
+  else if (publish && change_gate_)
+    {
+      // Compared on raw depth, the threshold is scaled to raw units.
+      const uint32_t threshold = (uint32_t) std::min(std::ceil(param_.change_threshold / scale.KA), 65535.0);
+
+      change = change_gate_->evaluate(depth, offset_x, offset_y, width, height, threshold, now);
+      publish = change.publish;
+
+      if (publish)
+        {
+          change_gate_->commit(depth, change, now);
+          crop = param_.change_region && !change.keyframe;
+        }
+      else
+        {
+          frames_unchanged_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+  bool streams_due = false;
+
+  for (const Stream &stream : streams_)
+    {
+      streams_due |= (frame_count_ % stream.param.divider) == 0;
+    }
+
+  if (!publish && !streams_due)
+    {
+      trace.Record(trace_sample_skipped, frame_count_);
+      frame_count_++;
+      return true;
+    }
 
   const int size = width * height;
+  const bool intensity_gate = intensity && param_.min_intensity > 0;
+  const bool range_gate = param_.min_valid > 0.0 || param_.max_valid > 0.0;
 
-  ToFCamera::MeasurementTopic::Data frame;
-  ToFCamera::MeasurementTopic::Codec::Initialize (frame);
+  if (publish && intensity && intensity_publisher_)
+    {
+      send_intensity(intensity, width, height, offset_x, offset_y, now);
+    }
+
+  // Encode straight from the raw planes when no other output needs the frame.
+  if (publish && encoder_ && encoder_verified_ && !streams_due && !mailbox_ && !shm_ && !intensity_gate && !range_gate && !crop && !batcher_ && !normals_)
+    {
+      const PlanarRegion region = {(T_UInt16) offset_x, (T_UInt16) offset_y, (T_UInt16) width, (T_UInt16) height};
+
+      encoder_->Encode(depth, confidence, region, scale, now);
+
+      const auto converted = std::chrono::steady_clock::now();
+      convert_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(converted - start).count());
+
+      Message message;
+      message.set_address(Address(node(), ToFCamera::MeasurementTopic::id));
+      message.append_payload(encoder_->data(), encoder_->size());
+
+      publisher_.Send(message);
+      trace.Record(trace_sample_published, frame_count_++);
+
+      const auto sent = std::chrono::steady_clock::now();
+      publish_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(sent - converted).count());
+      count_published(now);
+
+      return true;
+    }
+
+  // Range, confidence and intensity are converted in a single pass over
+  // the planes, by the pipeline built for the stages enabled.
+  ToFParameters stages(scale);
+  stages.min_intensity = intensity_gate ? (uint16_t) param_.min_intensity : 0;
+  stages.min_valid = param_.min_valid;
+  stages.max_valid = param_.max_valid;
+
+  const ToFPlanes planes = {depth, confidence, intensity, size};
+
+  // Converted straight into the ring slot when nothing else needs the frame.
+  if (publish && param_.shm_only && !streams_due && !normals_)
+    {
+      const uint64_t omitted = frame_count_ - shm_->Written();
 
-  // TODO: Also need offset
+      double *distances;
+      uint8_t *validity;
+
+      shm_->Begin(&distances, &validity);
+
+      select_tof_kernel<uint8_t>(intensity_gate, range_gate)(planes, stages, distances, validity, 0, 1);
+
+      shm_->Commit(camera_->FrameId(), omitted, now, (uint16_t) offset_x, (uint16_t) offset_y,
+                   (uint16_t) width, (uint16_t) height);
+
+      const auto converted = std::chrono::steady_clock::now();
+      convert_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(converted - start).count());
+
+      trace.Record(trace_sample_published, frame_count_++);
+      count_published(now);
+
+      return true;
+    }
+
+  ToFCamera::MeasurementTopic::Data &frame = (publish && mailbox_) ? mailbox_->back() : *frame_;
+
+  frame.region.offset_x = (T_UInt16) offset_x;
+  frame.region.offset_y = (T_UInt16) offset_y;
   frame.region.size_x = (T_UInt16) width;
   frame.region.size_y = (T_UInt16) height;
 
   frame.distances.nCount = size;
   frame.validity.nCount = size;
 
-  // Depth of 2**16 - 1 is max_depth, 0 is min_depth
-  const double KA = (max_depth_ - min_depth_) / 65535.0;
-  const double KB = min_depth_;
+  select_tof_kernel<DepthValidity>(intensity_gate, range_gate)
+  (planes, stages, frame.distances.arr, frame.validity.arr, depth_valid, depth_range_error);
 
-  for (int i = 0; i < size; i++)
+  frame.attributes.timestamp = now;
+  frame.attributes.validity = sample_valid;
+
+  if (publish && encoder_ && !encoder_verified_ && !intensity_gate && !range_gate)
     {
-      frame.distances.arr[i] = KA * depth[i] + KB;
+      verify_encoder(depth, confidence, scale, frame);
+    }
 
-      // TODO: Check if we can add threshold here?
-      if (depth[i] == 0 || confidence[i] == 0)
+  if (streams_due)
+    {
+      send_streams(frame);
+    }
+
+  trace.Record(trace_sample_converted, frame_count_, size);
+
+  const uint64_t frame_number = frame_count_++;
+
+  if (!publish)
+    {
+      return true;
+    }
+
+  if (normals_)
+    {
+      send_normals(frame);
+    }
+
+  const auto converted = std::chrono::steady_clock::now();
+  convert_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(converted - start).count());
+
+  // Readers may skip slots, so the ring always gets the full frame.
+  if (shm_)
+    {
+      send_shm(frame, camera_->FrameId(), frame_number);
+
+      if (param_.shm_only)
         {
-          frame.validity.arr[i] = depth_range_error;
+          trace.Record(trace_sample_published, frame_number);
+          count_published(now);
+          return true;
         }
     }
 
-  frame.attributes.timestamp = get_timestamp();
-  frame.attributes.validity = sample_valid;
+  if (crop)
+    {
+      crop_frame(frame, change);
+    }
+
+  if (batcher_)
+    {
+      send_batched(frame, frame_number);
+      return true;
+    }
+
+  if (mailbox_)
+    {
+      trace.Record(trace_sample_posted, frame_number, mailbox_->depth());
+      mailbox_->post(frame_number);
+    }
+  else
+    {
+      publisher_.Send<ToFCamera::MeasurementTopic> (frame);
+      trace.Record(trace_sample_published, frame_number);
 
-  publisher_.Send<ToFCamera::MeasurementTopic> (frame);
+      const auto sent = std::chrono::steady_clock::now();
+      publish_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(sent - converted).count());
+      count_published(now);
+    }
 
   return true;
 }
+
+void
+i3ds::BaslerToFCamera::send_streams(ToFCamera::MeasurementTopic::Data &frame)
+{
+  // Highest pyramid level needed by a stream that is due.
+  int top = 0;
+
+  for (const Stream &stream : streams_)
+    {
+      if ((frame_count_ % stream.param.divider) == 0 && stream.param.level > top)
+        {
+          top = stream.param.level;
+        }
+    }
+
+  for (int level = 1; level <= top; level++)
+    {
+      pyramid_down(level == 1 ? frame : *levels_[level - 2], *levels_[level - 1]);
+    }
+
+  for (Stream &stream : streams_)
+    {
+      if ((frame_count_ % stream.param.divider) == 0)
+        {
+          ToFCamera::MeasurementTopic::Data &data = stream.param.level == 0 ? frame : *levels_[stream.param.level - 1];
+
+          stream.publisher->Send<ToFCamera::MeasurementTopic> (data);
+        }
+    }
+}
+
+void
+i3ds::BaslerToFCamera::update_range(const uint16_t *depth, const uint16_t *confidence, int size)
+{
+  const BaslerToFWrapper::DepthRange &active = camera_->ActiveDepthRange();
+
+  // Committed between the last frame and this, it applies from this frame.
+  if (active.min_depth != depth_range_.min_depth || active.max_depth != depth_range_.max_depth)
+    {
+      depth_range_ = active;
+      min_depth_ = 1.0e-3 * active.min_depth;
+      max_depth_ = 1.0e-3 * active.max_depth;
+
+      housekeeping_->UpdateDepth(active.min_depth, active.max_depth);
+
+      // Raw depth of the reference is on the old scale.
+      if (change_gate_)
+        {
+          change_gate_->reset();
+        }
+    }
+
+  BaslerToFWrapper::DepthRange proposed;
+
+  if (range_adapter_->add(depth, confidence, size, depth_range_.min_depth, depth_range_.max_depth,
+                          &proposed.min_depth, &proposed.max_depth))
+    {
+      BOOST_LOG_TRIVIAL (info) << "Auto range proposes " << proposed.min_depth << "-" << proposed.max_depth << " mm";
+
+      // Staged, grabbing is restarted with the new range after this frame.
+      camera_->setDepthRange(proposed);
+    }
+}
+
+void
+i3ds::BaslerToFCamera::count_published(Timepoint grabbed)
+{
+  frames_published_.fetch_add(1, std::memory_order_relaxed);
+
+  if (trigger_timeline_.running())
+    {
+      trigger_timeline_.published(grabbed, get_timestamp());
+    }
+}
+
+void
+i3ds::BaslerToFCamera::crop_frame(ToFCamera::MeasurementTopic::Data &frame, const ChangeGate::Decision &change)
+{
+  const int width = frame.region.size_x;
+  const int crop_width = change.x1 - change.x0;
+  const int crop_height = change.y1 - change.y0;
+
+  // Rows are moved towards the start, so the frame can be cropped in place.
+  for (int y = 0; y < crop_height; y++)
+    {
+      const int from = (change.y0 + y) * width + change.x0;
+      const int to = y * crop_width;
+
+      memmove(frame.distances.arr + to, frame.distances.arr + from, crop_width * sizeof(frame.distances.arr[0]));
+      memmove(frame.validity.arr + to, frame.validity.arr + from, crop_width * sizeof(frame.validity.arr[0]));
+    }
+
+  frame.region.offset_x += change.x0;
+  frame.region.offset_y += change.y0;
+  frame.region.size_x = crop_width;
+  frame.region.size_y = crop_height;
+
+  frame.distances.nCount = crop_width * crop_height;
+  frame.validity.nCount = crop_width * crop_height;
+}
+
+long
+i3ds::BaslerToFCamera::dump_history(const std::string &path, int window_ms)
+{
+  if (!history_)
+    {
+      return -1;
+    }
+
+  const Timepoint now = get_timestamp();
+  const FrameHistory::DumpResult result = history_->Dump(path, now - 1000 * (int64_t) window_ms, now);
+
+  if (result.dropped > 0)
+    {
+      BOOST_LOG_TRIVIAL (warning) << "History dump lost " << result.dropped << " frames overwritten while copied";
+    }
+
+  return result.written;
+}
+
+void
+i3ds::BaslerToFCamera::send_normals(const ToFCamera::MeasurementTopic::Data &frame)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  normals_->compute(frame, sensor_width_, sensor_height_);
+
+  const auto computed = std::chrono::steady_clock::now();
+  normals_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(computed - start).count());
+
+  Camera::FrameTopic::Data &image = normals_frame_;
+
+  image.descriptor.attributes = frame.attributes;
+  image.descriptor.frame_mode = mode_mono;
+  image.descriptor.data_depth = 16;
+  image.descriptor.pixel_size = sizeof(int16_t);
+  image.descriptor.region = normals_->region();
+  image.descriptor.image_count = SurfaceNormals::channels;
+
+  // One signed mono image per channel: nx, ny, nz and planarity.
+  image.clear_images();
+
+  for (int c = 0; c < SurfaceNormals::channels; c++)
+    {
+      image.append_image((const byte *) normals_->plane(c), normals_->plane_size());
+    }
+
+  normals_publisher_->Send<Camera::FrameTopic> (image);
+}
+
+void
+i3ds::BaslerToFCamera::verify_encoder(const uint16_t *depth, const uint16_t *confidence, const DepthScale &scale,
+                                      const ToFCamera::MeasurementTopic::Data &frame)
+{
+  encoder_->Encode(depth, confidence, frame.region, scale, frame.attributes.timestamp);
+
+  if (encoder_->Matches(frame))
+    {
+      BOOST_LOG_TRIVIAL (info) << "Direct encoding verified against codec, " << encoder_->size() << " bytes";
+      encoder_verified_ = true;
+    }
+  else
+    {
+      BOOST_LOG_TRIVIAL (warning) << "Direct encoding differs from codec, using codec";
+      encoder_.reset();
+    }
+}
+
+void
+i3ds::BaslerToFCamera::send_intensity(const uint16_t *intensity, int width, int height,
+                                      int offset_x, int offset_y, Timepoint timestamp)
+{
+  Camera::FrameTopic::Data &image = intensity_frame_;
+
+  image.descriptor.attributes.timestamp = timestamp;
+  image.descriptor.attributes.validity = sample_valid;
+  image.descriptor.frame_mode = mode_mono;
+  image.descriptor.data_depth = 16;
+  image.descriptor.pixel_size = 2;
+  image.descriptor.region.offset_x = (T_UInt16) offset_x;
+  image.descriptor.region.offset_y = (T_UInt16) offset_y;
+  image.descriptor.region.size_x = (T_UInt16) width;
+  image.descriptor.region.size_y = (T_UInt16) height;
+  image.descriptor.image_count = 1;
+
+  // The image is sent before the camera buffer is returned to the driver.
+  image.clear_images();
+  image.append_image((const byte *) intensity, width * height * sizeof(uint16_t));
+
+  intensity_publisher_->Send<Camera::FrameTopic> (image);
+}
+
+void
+i3ds::BaslerToFCamera::send_batched(const ToFCamera::MeasurementTopic::Data &frame, uint64_t frame_number)
+{
+  std::lock_guard<std::mutex> lock(batch_mutex_);
+
+  if (!batcher_->Fits(frame.distances.nCount))
+    {
+      flush_batch();
+    }
+
+  bool added = batcher_->Add(frame);
+
+  // Did not fit after all, the frame starts a new batch.
+  if (!added && batcher_->Frames() > 0)
+    {
+      flush_batch();
+      added = batcher_->Add(frame);
+    }
+
+  if (!added)
+    {
+      BOOST_LOG_TRIVIAL (warning) << "Failed to encode frame " << frame_number << " for batch";
+      return;
+    }
+
+  TraceRing::Global().Record(trace_sample_posted, frame_number, batcher_->Frames());
+
+  if (batcher_->Due(get_timestamp(), period()))
+    {
+      flush_batch();
+    }
+  else if (batcher_->Frames() == 1)
+    {
+      // New batch, the sender waits for its deadline.
+      batch_cond_.notify_all();
+    }
+}
+
+void
+i3ds::BaslerToFCamera::stop_sender()
+{
+  if (mailbox_)
+    {
+      mailbox_->close();
+    }
+
+  if (batcher_)
+    {
+      std::lock_guard<std::mutex> lock(batch_mutex_);
+      batch_running_ = false;
+    }
+
+  batch_cond_.notify_all();
+
+  if (sender_.joinable())
+    {
+      sender_.join();
+    }
+
+  // Frames left in a batch when sampling stopped.
+  if (batcher_)
+    {
+      flush_batch();
+    }
+}
+
+void
+i3ds::BaslerToFCamera::batch_loop()
+{
+  std::unique_lock<std::mutex> lock(batch_mutex_);
+
+  while (batch_running_)
+    {
+      if (batcher_->Frames() == 0)
+        {
+          batch_cond_.wait(lock);
+          continue;
+        }
+
+      const int64_t left = batcher_->Deadline() - get_timestamp();
+
+      if (left > 0)
+        {
+          batch_cond_.wait_for(lock, std::chrono::microseconds(left));
+          continue;
+        }
+
+      flush_batch();
+    }
+}
+
+void
+i3ds::BaslerToFCamera::flush_batch()
+{
+  // Called with batch_mutex_ held, or with the sender stopped.
+  if (batcher_->Frames() == 0)
+    {
+      return;
+    }
+
+  const auto start = std::chrono::steady_clock::now();
+  const std::vector<Timepoint> timestamps = batcher_->Timestamps();
+
+  batcher_->Flush(*batch_publisher_);
+
+  const auto sent = std::chrono::steady_clock::now();
+  publish_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(sent - start).count());
+
+  for (Timepoint t : timestamps)
+    {
+      count_published(t);
+    }
+}
+
+void
+i3ds::BaslerToFCamera::send_shm(const ToFCamera::MeasurementTopic::Data &frame, uint64_t sequence, uint64_t frame_number)
+{
+  const int size = frame.distances.nCount;
+
+  // Copy of a frame converted for other outputs as well. In shared memory
+  // only mode the conversion writes the slot directly.
+
+  // Frames handled before this one that were decimated, unchanged or only
+  // used for streams, so readers can tell them from frames lost.
+  const uint64_t omitted = frame_number - shm_->Written();
+
+  double *distances;
+  uint8_t *validity;
+
+  shm_->Begin(&distances, &validity);
+
+  memcpy(distances, frame.distances.arr, size * sizeof(double));
+
+  for (int i = 0; i < size; i++)
+    {
+      validity[i] = frame.validity.arr[i] == depth_valid ? 0 : 1;
+    }
+
+  shm_->Commit(sequence, omitted, frame.attributes.timestamp, frame.region.offset_x, frame.region.offset_y,
+               frame.region.size_x, frame.region.size_y);
+}
+
+void
+i3ds::BaslerToFCamera::send_loop()
+{
+  ToFCamera::MeasurementTopic::Data *frame;
+  uint64_t frame_number;
+
+  while ((frame = mailbox_->take(&frame_number)) != nullptr)
+    {
+      const auto start = std::chrono::steady_clock::now();
+
+      publisher_.Send<ToFCamera::MeasurementTopic> (*frame);
+      TraceRing::Global().Record(trace_sample_published, frame_number);
+
+      const auto sent = std::chrono::steady_clock::now();
+      publish_time_.record(std::chrono::duration_cast<std::chrono::microseconds>(sent - start).count());
+      count_published(frame->attributes.timestamp);
+    }
+}
+
+void
+i3ds::BaslerToFCamera::start_telemetry()
+{
+  if (!telemetry_publisher_ || telemetry_.joinable())
+    {
+      return;
+    }
+
+  telemetry_running_ = true;
+  telemetry_ = std::thread(&i3ds::BaslerToFCamera::telemetry_loop, this);
+}
+
+void
+i3ds::BaslerToFCamera::stop_telemetry()
+{
+  {
+    std::lock_guard<std::mutex> lock(telemetry_mutex_);
+    telemetry_running_ = false;
+  }
+
+  telemetry_cond_.notify_all();
+
+  if (telemetry_.joinable())
+    {
+      telemetry_.join();
+    }
+}
+
+void
+i3ds::BaslerToFCamera::telemetry_loop()
+{
+  Analog::MeasurementTopic::Data telemetry;
+  Analog::MeasurementTopic::Codec::Initialize (telemetry);
+
+  telemetry.series = telemetry_samples;
+  telemetry.batch_size = 1;
+  telemetry.samples.nCount = telemetry_samples;
+
+  std::unique_lock<std::mutex> lock(telemetry_mutex_);
+
+  while (!telemetry_cond_.wait_for(lock, std::chrono::milliseconds(param_.telemetry_period),
+                                   [this] {return !telemetry_running_;}))
+    {
+      const LatencyHistogram::Snapshot convert = convert_time_.take();
+      const LatencyHistogram::Snapshot publish = publish_time_.take();
+      const TriggerTimeline::Snapshot trigger = trigger_timeline_.take();
+
+      float *sample = telemetry.samples.arr;
+
+      sample[telemetry_acquired] = camera_->FramesAcquired();
+      sample[telemetry_published] = frames_published_;
+      sample[telemetry_decimated] = frames_decimated();
+      sample[telemetry_discarded] = frames_discarded();
+      sample[telemetry_timeouts] = camera_->Timeouts();
+      sample[telemetry_queue_depth] = mailbox_ ? mailbox_->depth() : 0;
+      sample[telemetry_convert_p50] = convert.percentile(0.50);
+      sample[telemetry_convert_p99] = convert.percentile(0.99);
+      sample[telemetry_publish_p50] = publish.percentile(0.50);
+      sample[telemetry_publish_p99] = publish.percentile(0.99);
+      sample[telemetry_sampler_cpu_time] = camera_->SamplerCpuTime();
+      sample[telemetry_temperature] = temperature();
+      sample[telemetry_unchanged] = frames_unchanged_;
+      sample[telemetry_trigger_grab_p50] = trigger.grab.percentile(0.50);
+      sample[telemetry_trigger_grab_p99] = trigger.grab.percentile(0.99);
+      sample[telemetry_trigger_publish_p50] = trigger.publish.percentile(0.50);
+      sample[telemetry_trigger_publish_p99] = trigger.publish.percentile(0.99);
+      sample[telemetry_trigger_jitter] = trigger.jitter;
+      sample[telemetry_trigger_missed] = trigger.missed;
+      sample[telemetry_driver_gaps] = camera_->DriverGaps();
+      sample[telemetry_grab_drops] = camera_->GrabDrops();
+
+      if (executor_)
+        {
+          const LatencyHistogram::Snapshot command = executor_->Latency().take();
+
+          sample[telemetry_command_p50] = command.percentile(0.50);
+          sample[telemetry_command_p99] = command.percentile(0.99);
+          sample[telemetry_commands_coalesced] = executor_->Coalesced();
+        }
+
+      const LatencyHistogram::Snapshot normals = normals_time_.take();
+
+      sample[telemetry_normals_p50] = normals.percentile(0.50);
+      sample[telemetry_normals_p99] = normals.percentile(0.99);
+
+      if (thermal_)
+        {
+          const ThermalCompensation::Entry correction = thermal_->at(housekeeping_->GetStatus()->temperature);
+
+          sample[telemetry_thermal_offset] = correction.offset;
+          sample[telemetry_thermal_scale] = correction.scale;
+        }
+
+      telemetry.attributes.timestamp = get_timestamp();
+      telemetry.attributes.validity = sample_valid;
+
+      telemetry_publisher_->Send<Analog::MeasurementTopic> (telemetry);
+    }
+}
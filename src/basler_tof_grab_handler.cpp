@@ -0,0 +1,173 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "basler_tof_grab_handler.hpp"
+#include "trace_ring.hpp"
+
+#include <time.h>
+
+#define BOOST_LOG_DYN_LINK
+
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+using namespace GenTLConsumerImplHelper;
+
+BaslerToFGrabHandler::BaslerToFGrabHandler(Operation operation)
+  : operation_(operation),
+    timeout_counter_(0),
+    error_flagged_(false),
+    last_frame_id_(0),
+    frames_acquired_(0),
+    driver_gaps_(0),
+    grab_drops_(0),
+    timeouts_(0),
+    sampler_cpu_time_(0)
+{
+}
+
+void
+BaslerToFGrabHandler::Reset()
+{
+  timeout_counter_ = 0;
+  error_flagged_ = false;
+  error_message_.clear();
+  last_frame_id_ = 0;
+}
+
+void
+BaslerToFGrabHandler::SetError(const std::string &error_message)
+{
+  BOOST_LOG_TRIVIAL(error) << "Error message: " << error_message;
+  error_flagged_ = true;
+  error_message_ = error_message;
+}
+
+bool
+BaslerToFGrabHandler::SignalError(const Error_signaler &error_signaler) const
+{
+  if (!error_flagged_)
+    {
+      return false;
+    }
+
+  error_signaler(error_message_, true);
+
+  return true;
+}
+
+bool
+BaslerToFGrabHandler::Handle(const GrabResult &result, const BufferParts &parts,
+                             bool connected, int offset_x, int offset_y)
+{
+  i3ds::TraceRing &trace = i3ds::TraceRing::Global();
+
+  struct timespec cpu;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu) == 0)
+    {
+      sampler_cpu_time_.store(cpu.tv_sec * 1000000000LL + cpu.tv_nsec, std::memory_order_relaxed);
+    }
+
+  if (!connected)
+    {
+      trace.Record(i3ds::trace_grab_disconnected, frames_acquired_);
+      SetError("Camera reporting: Not connected. Going to error state.");
+
+      return false;
+    }
+
+  if (result.status == GrabResult::Timeout)
+    {
+      trace.Record(i3ds::trace_grab_timeout, frames_acquired_, timeout_counter_ + 1);
+      BOOST_LOG_TRIVIAL(info) << "Timeout waiting for image";
+      timeout_counter_ ++;
+      timeouts_.fetch_add(1, std::memory_order_relaxed);
+
+      if (timeout_counter_ > max_timeouts)
+        {
+          SetError("More than " + std::to_string(max_timeouts) + " timeouts in sampling loop. Going to error state.");
+          return false;
+        }
+
+      return true; // Just continue and wait for another image.
+    }
+
+  if (result.status != GrabResult::Ok)
+    {
+      trace.Record(i3ds::trace_grab_failed, frames_acquired_, result.status);
+      grab_drops_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+  // Frame IDs not seen were dropped by the driver. IDs restart when grabbing
+  // is restarted, which is not a gap.
+  if (last_frame_id_ > 0 && result.frameId > last_frame_id_ + 1)
+    {
+      trace.Record(i3ds::trace_grab_gap, frames_acquired_, (uint32_t) (result.frameId - last_frame_id_ - 1));
+      driver_gaps_.fetch_add(result.frameId - last_frame_id_ - 1, std::memory_order_relaxed);
+    }
+
+  last_frame_id_ = result.frameId;
+
+  // Parts are dispatched by type, range and confidence are required.
+  const PartInfo *range = nullptr;
+  const PartInfo *confidence = nullptr;
+  const PartInfo *intensity = nullptr;
+
+  for (const PartInfo &part : parts)
+    {
+      switch (part.partType)
+        {
+        case Range:
+          range = &part;
+          break;
+
+        case Confidence:
+          confidence = &part;
+          break;
+
+        case Intensity:
+          intensity = &part;
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  // A layout error is a configuration fault, so it goes to error state
+  // instead of throwing out of the grab loop.
+  if (!range || !confidence ||
+      confidence->width != range->width || confidence->height != range->height ||
+      (intensity && (intensity->width != range->width || intensity->height != range->height)))
+    {
+      trace.Record(i3ds::trace_grab_failed, frames_acquired_, (uint32_t) parts.size());
+      grab_drops_.fetch_add(1, std::memory_order_relaxed);
+      SetError("Invalid configuration of measurement");
+
+      return false;
+    }
+
+  const int width =(int) range->width;
+  const int height =(int) range->height;
+
+  timeout_counter_ = 0;
+
+  trace.Record(i3ds::trace_grab_ok, frames_acquired_.fetch_add(1, std::memory_order_relaxed), width * height);
+
+  operation_((const uint16_t *) range->pData,
+             (const uint16_t *) confidence->pData,
+             intensity ? (const uint16_t *) intensity->pData : nullptr,
+             width, height, offset_x, offset_y);
+
+  return true;
+}
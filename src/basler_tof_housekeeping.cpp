@@ -0,0 +1,199 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "basler_tof_housekeeping.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#define BOOST_LOG_DYN_LINK
+
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+BaslerToFHousekeeping::BaslerToFHousekeeping(BaslerToFWrapper &camera, int temperature_period, int limits_period)
+  : camera_(camera),
+    temperature_period_(temperature_period),
+    limits_period_(limits_period),
+    depth_generation_(0),
+    rate_generation_(0),
+    running_(false)
+{
+}
+
+BaslerToFHousekeeping::~BaslerToFHousekeeping()
+{
+  Stop();
+}
+
+void
+BaslerToFHousekeeping::Start()
+{
+  std::shared_ptr<Status> status(new Status);
+
+  PollTemperature(*status);
+  PollLimits(*status);
+
+  std::atomic_store(&status_, StatusPtr(status));
+
+  running_ = true;
+  thread_ = std::thread(&BaslerToFHousekeeping::Loop, this);
+}
+
+void
+BaslerToFHousekeeping::Stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+
+  cond_.notify_all();
+
+  if (thread_.joinable())
+    {
+      thread_.join();
+    }
+}
+
+void
+BaslerToFHousekeeping::UpdateDepth(int64_t min_depth, int64_t max_depth)
+{
+  std::lock_guard<std::mutex> lock(update_mutex_);
+
+  std::shared_ptr<Status> status(new Status(*GetStatus()));
+
+  status->min_depth = min_depth;
+  status->max_depth = max_depth;
+  depth_generation_++;
+
+  std::atomic_store(&status_, StatusPtr(status));
+}
+
+void
+BaslerToFHousekeeping::UpdateTriggerRate(float min_trigger_rate, float max_trigger_rate)
+{
+  std::lock_guard<std::mutex> lock(update_mutex_);
+
+  std::shared_ptr<Status> status(new Status(*GetStatus()));
+
+  status->min_trigger_rate = min_trigger_rate;
+  status->max_trigger_rate = max_trigger_rate;
+  rate_generation_++;
+
+  std::atomic_store(&status_, StatusPtr(status));
+}
+
+void
+BaslerToFHousekeeping::PollTemperature(Status &status)
+{
+  status.connected = camera_.IsConnected();
+  status.temperature = camera_.getTemperature();
+}
+
+void
+BaslerToFHousekeeping::PollLimits(Status &status)
+{
+  status.min_depth = camera_.getMinDepth();
+  status.max_depth = camera_.getMaxDepth();
+  status.min_depth_lower_limit = camera_.getMinDepth_lower_limit();
+  status.max_depth_upper_limit = camera_.getMaxDepth_upper_limit();
+  status.min_trigger_rate = camera_.minTriggerRate();
+  status.max_trigger_rate = camera_.maxTriggerRate();
+  status.processing_mode = camera_.getEnum("ProcessingMode");
+}
+
+void
+BaslerToFHousekeeping::Loop()
+{
+  typedef std::chrono::steady_clock Clock;
+
+  Clock::time_point next_temperature = Clock::now() + std::chrono::milliseconds(temperature_period_);
+  Clock::time_point next_limits = Clock::now() + std::chrono::milliseconds(limits_period_);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!cond_.wait_until(lock, std::min(next_temperature, next_limits), [this] {return !running_;}))
+    {
+      const Clock::time_point now = Clock::now();
+
+      const bool temperature = now >= next_temperature;
+      const bool limits = now >= next_limits;
+
+      // Device is read without holding the update lock, values that fail
+      // to be read keep their previous value.
+      Status polled = *GetStatus();
+      uint64_t generation, rate_generation;
+
+      {
+        std::lock_guard<std::mutex> update(update_mutex_);
+        generation = depth_generation_;
+        rate_generation = rate_generation_;
+      }
+
+      try
+        {
+          if (temperature)
+            {
+              PollTemperature(polled);
+            }
+
+          if (limits)
+            {
+              PollLimits(polled);
+            }
+        }
+      catch (const GenICam::GenericException &e)
+        {
+          BOOST_LOG_TRIVIAL(warning) << "Housekeeping failed to read camera: " << e.what();
+          polled.connected = false;
+        }
+
+      {
+        std::lock_guard<std::mutex> update(update_mutex_);
+
+        std::shared_ptr<Status> status(new Status(*GetStatus()));
+
+        status->connected = polled.connected;
+
+        if (temperature)
+          {
+            status->temperature = polled.temperature;
+            next_temperature = now + std::chrono::milliseconds(temperature_period_);
+          }
+
+        if (limits)
+          {
+            // Depth written while polling is newer than the polled value.
+            if (generation == depth_generation_)
+              {
+                status->min_depth = polled.min_depth;
+                status->max_depth = polled.max_depth;
+              }
+
+            status->min_depth_lower_limit = polled.min_depth_lower_limit;
+            status->max_depth_upper_limit = polled.max_depth_upper_limit;
+            status->processing_mode = polled.processing_mode;
+
+            // Likewise for rate limits read after a region was written.
+            if (rate_generation == rate_generation_)
+              {
+                status->min_trigger_rate = polled.min_trigger_rate;
+                status->max_trigger_rate = polled.max_trigger_rate;
+              }
+
+            next_limits = now + std::chrono::milliseconds(limits_period_);
+          }
+
+        std::atomic_store(&status_, StatusPtr(status));
+      }
+    }
+}
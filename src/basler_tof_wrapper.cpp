@@ -9,6 +9,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "basler_tof_wrapper.hpp"
+#include "trace_ring.hpp"
 #include <exception>
 
 
@@ -23,8 +24,9 @@ using namespace GenTLConsumerImplHelper;
 #include <boost/log/trivial.hpp>
 #include <boost/log/expressions.hpp>
 
-BaslerToFWrapper::BaslerToFWrapper(std::string camera_name, Operation operation, Error_signaler error_signaler )
-  : operation_(operation ), error_signaler_( error_signaler )
+BaslerToFWrapper::BaslerToFWrapper(std::string camera_name, bool intensity, Operation operation, Error_signaler error_signaler )
+  : error_signaler_( error_signaler ), region_pending_(false), depth_pending_(false),
+    handler_(operation), running_(false)
 {
   setenv("GENICAM_GENTL64_PATH", GENICAM_GENTL64_PATH, 1 );
 
@@ -36,7 +38,7 @@ BaslerToFWrapper::BaslerToFWrapper(std::string camera_name, Operation operation,
       // These are fixed settings for I3DS.
       setSelector("Range", true );
       setEnum("PixelFormat", "Coord3D_C16" );
-      setSelector("Intensity", false );
+      setSelector("Intensity", intensity );
       setSelector("Confidence", true );
 
 #ifndef HDR
@@ -51,6 +53,8 @@ BaslerToFWrapper::BaslerToFWrapper(std::string camera_name, Operation operation,
       setFloat("Agility", 0.1);
       setInt("Delay", 1);
 
+      active_region_ = {OffsetX(), OffsetY(), Width(), Height()};
+      active_depth_ = {getMinDepth(), getMaxDepth()};
     }
   catch(const GenICam::GenericException &e)
     {
@@ -210,6 +214,131 @@ BaslerToFWrapper::setOffsetY(int64_t value)
   setInt("OffsetY", value);
 }
 
+void
+BaslerToFWrapper::setRegion(const Region &region)
+{
+  // Not sampling, region can be written to the camera directly.
+  if (!sampler_.joinable())
+    {
+      ApplyRegion(region);
+      return;
+    }
+
+  std::lock_guard<std::mutex> lock(region_mutex_);
+
+  staged_region_ = region;
+  region_pending_ = true;
+}
+
+void
+BaslerToFWrapper::ApplyRegion(const Region &region)
+{
+  // Decrease first, increase afterwards
+  if (region.width > Width())
+    {
+      setOffsetX(region.offset_x);
+      setWidth(region.width);
+    }
+  else
+    {
+      setWidth(region.width);
+      setOffsetX(region.offset_x);
+    }
+
+  if (region.height > Height())
+    {
+      setOffsetY(region.offset_y);
+      setHeight(region.height);
+    }
+  else
+    {
+      setHeight(region.height);
+      setOffsetY(region.offset_y);
+    }
+
+  const Region applied = {OffsetX(), OffsetY(), Width(), Height()};
+
+  std::lock_guard<std::mutex> lock(region_mutex_);
+  active_region_ = applied;
+}
+
+BaslerToFWrapper::Region
+BaslerToFWrapper::GetRegion()
+{
+  std::lock_guard<std::mutex> lock(region_mutex_);
+
+  return region_pending_ ? staged_region_ : active_region_;
+}
+
+void
+BaslerToFWrapper::setDepthRange(const DepthRange &range)
+{
+  // Not sampling, range can be written to the camera directly.
+  if (!sampler_.joinable())
+    {
+      ApplyDepthRange(range);
+      return;
+    }
+
+  std::lock_guard<std::mutex> lock(region_mutex_);
+
+  staged_depth_ = range;
+  depth_pending_ = true;
+}
+
+void
+BaslerToFWrapper::ApplyDepthRange(const DepthRange &range)
+{
+  // Keep min below max while writing, as for the region.
+  if (range.min_depth >= active_depth_.max_depth)
+    {
+      setMaxDepth(range.max_depth);
+      setMinDepth(range.min_depth);
+    }
+  else
+    {
+      setMinDepth(range.min_depth);
+      setMaxDepth(range.max_depth);
+    }
+
+  active_depth_ = {getMinDepth(), getMaxDepth()};
+}
+
+void
+BaslerToFWrapper::CommitStaged()
+{
+  Region region;
+  DepthRange depth;
+  bool commit_region, commit_depth;
+
+  {
+    std::lock_guard<std::mutex> lock(region_mutex_);
+
+    region = staged_region_;
+    depth = staged_depth_;
+    commit_region = region_pending_.exchange(false);
+    commit_depth = depth_pending_.exchange(false);
+  }
+
+  if (commit_region)
+    {
+      BOOST_LOG_TRIVIAL(info) << "Commit region " << region.width << "x" << region.height
+                              << "+" << region.offset_x << "+" << region.offset_y;
+
+      ApplyRegion(region);
+
+      i3ds::TraceRing::Global().Record(i3ds::trace_region_commit, handler_.FramesAcquired(),
+                                       (uint32_t) (active_region_.width * active_region_.height));
+    }
+
+  if (commit_depth)
+    {
+      BOOST_LOG_TRIVIAL(info) << "Commit depth range " << depth.min_depth << "-" << depth.max_depth << " mm";
+
+      ApplyDepthRange(depth);
+    }
+}
+
 int64_t
 BaslerToFWrapper::SensorWidth()
 {
@@ -311,13 +440,17 @@ BaslerToFWrapper::GetDeviceModelName()
   return interfaceDisplayName.c_str();
 }
 
+bool
+BaslerToFWrapper::IsConnected()
+{
+  return camera_.IsConnected();
+}
+
 void
 BaslerToFWrapper::Start()
 {
   running_ = true;
-  timeout_counter_ = 0;
-  error_counter_ = 0;
-  error_flagged_ = false;
+  handler_.Reset();
 
   sampler_ = std::thread(&BaslerToFWrapper::SampleLoop, this);
 }
@@ -331,6 +464,12 @@ BaslerToFWrapper::Stop()
     {
       sampler_.join();
     }
+
+  // Region or range staged after the last frame was grabbed.
+  if (region_pending_ || depth_pending_)
+    {
+      CommitStaged();
+    }
 }
 
 void
@@ -338,78 +477,39 @@ BaslerToFWrapper::SampleLoop()
 {
   try
     {
-      // Start grabbing with buffer size 15 and 500 ms timeout.
-      error_flagged_ = false;
-      camera_.GrabContinuous(15, 500, this, &BaslerToFWrapper::HandleResult);
-
-      if (error_flagged_)
+      // Grabbing is stopped to commit a staged region or range, then restarted.
+      do
         {
-          error_signaler_ (flagged_error_message_, true);
-          error_flagged_ = false;
+          if (region_pending_ || depth_pending_)
+            {
+              CommitStaged();
+            }
+
+          handler_.ResetFrameId();
+
+          // Start grabbing with buffer size 15 and 500 ms timeout.
+          camera_.GrabContinuous(15, 500, this, &BaslerToFWrapper::HandleResult);
         }
+      while (running_ && (region_pending_ || depth_pending_));
+
+      handler_.SignalError(error_signaler_);
     }
   catch(const GenICam::GenericException &e)
     {
       BOOST_LOG_TRIVIAL(error) <<  "Exception error message: " << e.what();
+      error_signaler_ ("Error in sampling loop: " + std::string(e.what()), true);
     }
 }
 
-void
-BaslerToFWrapper::set_error_status(const std::string error_message)
-{
-  BOOST_LOG_TRIVIAL(error) << "set_error_status() in wrapper";
-  BOOST_LOG_TRIVIAL(error) <<  "Error message: " << error_message;
-  error_flagged_ = true;
-  flagged_error_message_ = error_message;
-}
-
 bool
 BaslerToFWrapper::HandleResult(GrabResult result, BufferParts parts)
 {
-  BOOST_LOG_TRIVIAL(trace) << "HandleResult()";
-
-  if (!camera_.IsConnected())
+  if (!handler_.Handle(result, parts, camera_.IsConnected(),
+                       (int) active_region_.offset_x, (int) active_region_.offset_y))
     {
-      BOOST_LOG_TRIVIAL(error) << "Camera reporting: Not connected. Going to error state.";
-      set_error_status("Camera reporting: Not connected. Going to error state.");
       running_ = false;
-
-      return running_;
-    }
-
-  if (result.status == GrabResult::Timeout)
-    {
-      BOOST_LOG_TRIVIAL(info) << "Timeout waiting for image";
-      timeout_counter_ ++;
-
-      if (timeout_counter_ > 10)
-        {
-          BOOST_LOG_TRIVIAL(error) << "More than 10 error in sampling loop. Going to error state";
-          set_error_status("Camera reporting: Not connected. Going to error state.");
-          running_ = false;
-        }
-
-      return running_; // Just continue and wait for another image.
-    }
-
-  if (result.status == GrabResult::Ok)
-    {
-      const int width =(int) parts[0].width;
-      const int height =(int) parts[0].height;
-      const uint16_t *depth =(uint16_t *) parts[0].pData;
-      const uint16_t *confidence =(uint16_t *) parts[1].pData;
-
-      if (parts[0].partType != Range || parts[1].partType != Confidence)
-        {
-          BOOST_LOG_TRIVIAL(error) << "Invalid configuration of measurement";
-          throw std::logic_error("Invalid configuration of measurement");
-        }
-
-      timeout_counter_ = 0;
-      error_counter_ = 0;
-
-      operation_(depth, confidence, width, height);
     }
 
-  return running_;
+  // Stop grabbing after this frame if a new region or range is staged.
+  return running_ && !region_pending_ && !depth_pending_;
 }
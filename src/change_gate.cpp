@@ -0,0 +1,149 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "change_gate.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+i3ds::ChangeGate::ChangeGate(int max_pixels)
+  : reference_(max_pixels),
+    offset_x_(0),
+    offset_y_(0),
+    width_(0),
+    height_(0),
+    min_changed_(0.0),
+    keyframe_period_(0),
+    last_keyframe_(0)
+{
+}
+
+void
+i3ds::ChangeGate::configure(double min_changed, int64_t keyframe_period)
+{
+  min_changed_ = min_changed;
+  keyframe_period_ = keyframe_period;
+
+  reset();
+}
+
+void
+i3ds::ChangeGate::reset()
+{
+  width_ = 0;
+  height_ = 0;
+}
+
+// Sum of absolute differences of a row, written to vectorize.
+static uint32_t
+row_sad(const uint16_t *a, const uint16_t *b, int n)
+{
+  uint32_t sum = 0;
+
+  for (int i = 0; i < n; i++)
+    {
+      const int d = (int) a[i] - (int) b[i];
+      sum += d < 0 ? -d : d;
+    }
+
+  return sum;
+}
+
+i3ds::ChangeGate::Decision
+i3ds::ChangeGate::evaluate(const uint16_t *depth, int offset_x, int offset_y, int width, int height,
+                           uint32_t threshold, int64_t now)
+{
+  Decision d;
+
+  const int tiles_x = (width + tile - 1) / tile;
+  const int tiles_y = (height + tile - 1) / tile;
+
+  d.tiles = tiles_x * tiles_y;
+
+  // New region or heartbeat due, publish everything.
+  if (width != width_ || height != height_ || offset_x != offset_x_ || offset_y != offset_y_ ||
+      now - last_keyframe_ >= keyframe_period_)
+    {
+      // A keyframe is always published, its region is the new reference.
+      offset_x_ = offset_x;
+      offset_y_ = offset_y;
+
+      d.publish = true;
+      d.keyframe = true;
+      d.x0 = 0;
+      d.y0 = 0;
+      d.x1 = width;
+      d.y1 = height;
+      d.changed = d.tiles;
+
+      return d;
+    }
+
+  d.keyframe = false;
+  d.changed = 0;
+  d.x0 = width;
+  d.y0 = height;
+  d.x1 = 0;
+  d.y1 = 0;
+
+  for (int ty = 0; ty < tiles_y; ty++)
+    {
+      const int y0 = ty * tile;
+      const int y1 = std::min(y0 + tile, height);
+
+      for (int tx = 0; tx < tiles_x; tx++)
+        {
+          const int x0 = tx * tile;
+          const int x1 = std::min(x0 + tile, width);
+
+          uint32_t sad = 0;
+
+          for (int y = y0; y < y1; y++)
+            {
+              const int row = y * width;
+              sad += row_sad(depth + row + x0, reference_.data() + row + x0, x1 - x0);
+            }
+
+          // Mean absolute difference above threshold.
+          if (sad > (uint64_t) threshold * (uint64_t) ((x1 - x0) * (y1 - y0)))
+            {
+              d.changed++;
+              d.x0 = std::min(d.x0, x0);
+              d.y0 = std::min(d.y0, y0);
+              d.x1 = std::max(d.x1, x1);
+              d.y1 = std::max(d.y1, y1);
+            }
+        }
+    }
+
+  d.publish = d.changed > 0 && d.changed >= min_changed_ * d.tiles;
+
+  return d;
+}
+
+void
+i3ds::ChangeGate::commit(const uint16_t *depth, const Decision &decision, int64_t now)
+{
+  if (decision.keyframe)
+    {
+      width_ = decision.x1;
+      height_ = decision.y1;
+      last_keyframe_ = now;
+
+      memcpy(reference_.data(), depth, width_ * height_ * sizeof(uint16_t));
+      return;
+    }
+
+  for (int y = decision.y0; y < decision.y1; y++)
+    {
+      const int start = y * width_ + decision.x0;
+      memcpy(reference_.data() + start, depth + start, (decision.x1 - decision.x0) * sizeof(uint16_t));
+    }
+}
@@ -0,0 +1,164 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "depth_range_adapter.hpp"
+
+#include <algorithm>
+
+// Raw depth within 1% of either end counts as the edge of the range.
+static const uint16_t edge = 655;
+
+// Fraction of pixels at an edge that widens the range on that side.
+static const double edge_fraction = 0.05;
+
+// Range is only narrowed if it shrinks by more than this fraction.
+static const double hysteresis = 0.25;
+
+// Smallest range proposed, and least number of pixels to propose from.
+static const int64_t min_span = 200;
+static const uint64_t min_total = 1000;
+
+i3ds::DepthRangeAdapter::DepthRangeAdapter(int64_t lower_limit, int64_t upper_limit, int period)
+  : lower_limit_(lower_limit), upper_limit_(upper_limit), period_(period),
+    frames_(0), total_(0), low_edge_(0), high_edge_(0)
+{
+  std::fill(count_, count_ + bins, 0);
+}
+
+bool
+i3ds::DepthRangeAdapter::add(const uint16_t *depth, const uint16_t *confidence, int size,
+                             int64_t min_depth, int64_t max_depth, int64_t *new_min, int64_t *new_max)
+{
+  // Raw depth to histogram bin over the device limits, bin = a * raw + b.
+  const float limits = (float) (upper_limit_ - lower_limit_);
+  const float a = (float) (max_depth - min_depth) / 65535.0f * bins / limits;
+  const float b = (float) (min_depth - lower_limit_) * bins / limits;
+
+  for (int i = 0; i < size; i += stride)
+    {
+      if (depth[i] == 0 || confidence[i] == 0)
+        {
+          continue;
+        }
+
+      const int bin = std::min(std::max((int) (a * depth[i] + b), 0), bins - 1);
+
+      count_[bin]++;
+      total_++;
+
+      low_edge_ += depth[i] < edge;
+      high_edge_ += depth[i] > 65535 - edge;
+    }
+
+  if (++frames_ < period_)
+    {
+      return false;
+    }
+
+  const bool changed = propose(min_depth, max_depth, new_min, new_max);
+
+  // Decay, so the histogram follows the scene.
+  total_ = 0;
+
+  for (int i = 0; i < bins; i++)
+    {
+      count_[i] /= 2;
+      total_ += count_[i];
+    }
+
+  frames_ = 0;
+  low_edge_ = 0;
+  high_edge_ = 0;
+
+  return changed;
+}
+
+int64_t
+i3ds::DepthRangeAdapter::percentile(double p) const
+{
+  uint64_t seen = 0;
+  int i = 0;
+
+  for (; i < bins - 1; i++)
+    {
+      seen += count_[i];
+
+      if (seen >= p * total_)
+        {
+          break;
+        }
+    }
+
+  return lower_limit_ + (upper_limit_ - lower_limit_) * i / bins;
+}
+
+bool
+i3ds::DepthRangeAdapter::propose(int64_t min_depth, int64_t max_depth, int64_t *new_min, int64_t *new_max)
+{
+  if (total_ < min_total)
+    {
+      return false;
+    }
+
+  const int64_t bin_size = (upper_limit_ - lower_limit_) / bins + 1;
+  const int64_t span = max_depth - min_depth;
+
+  const int64_t low = percentile(0.01);
+  const int64_t high = percentile(0.99) + bin_size;
+  const int64_t margin = std::max((high - low) / 10, bin_size);
+
+  int64_t target_min = low - margin;
+  int64_t target_max = high + margin;
+
+  // Scene is clipped at an end, widen by a quarter of the range on that side.
+  const uint64_t sampled_edge = (uint64_t) (edge_fraction * total_);
+
+  if (low_edge_ > sampled_edge)
+    {
+      target_min = std::min(target_min, min_depth - span / 4);
+    }
+
+  if (high_edge_ > sampled_edge)
+    {
+      target_max = std::max(target_max, max_depth + span / 4);
+    }
+
+  target_min = std::max(target_min, lower_limit_);
+  target_max = std::min(target_max, upper_limit_);
+
+  if (target_max - target_min < min_span)
+    {
+      const int64_t center = (target_min + target_max) / 2;
+
+      target_min = std::max(center - min_span / 2, lower_limit_);
+      target_max = std::min(target_min + min_span, upper_limit_);
+    }
+
+  // Widen at once if the scene is outside, narrow only on a large change.
+  const bool widen = target_min < min_depth || target_max > max_depth;
+  const bool narrow = target_max - target_min < (1.0 - hysteresis) * span;
+
+  if (!widen && !narrow)
+    {
+      return false;
+    }
+
+  // Keep the side not widened, so the scene does not oscillate between them.
+  if (widen && !narrow)
+    {
+      target_min = std::min(target_min, min_depth);
+      target_max = std::max(target_max, max_depth);
+    }
+
+  *new_min = target_min;
+  *new_max = target_max;
+
+  return target_min != min_depth || target_max != max_depth;
+}
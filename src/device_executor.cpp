@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "device_executor.hpp"
+
+#include <exception>
+
+#define BOOST_LOG_DYN_LINK
+
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+i3ds::DeviceExecutor::DeviceExecutor(ErrorHandler error_handler)
+  : error_handler_(error_handler),
+    busy_(false),
+    running_(true),
+    coalesced_(0)
+{
+  thread_ = std::thread(&DeviceExecutor::Loop, this);
+}
+
+i3ds::DeviceExecutor::~DeviceExecutor()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+
+  cond_.notify_all();
+  thread_.join();
+}
+
+void
+i3ds::DeviceExecutor::Submit(const std::string &key, Command command)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    for (Entry &entry : queue_)
+      {
+        if (entry.key == key)
+          {
+            // Keeps its place in the queue, latency counts from the first.
+            entry.command = command;
+            coalesced_++;
+            return;
+          }
+      }
+
+    queue_.push_back({key, command, Clock::now()});
+  }
+
+  cond_.notify_all();
+}
+
+void
+i3ds::DeviceExecutor::Drain()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  idle_cond_.wait(lock, [this] {return queue_.empty() && !busy_;});
+}
+
+void
+i3ds::DeviceExecutor::Loop()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true)
+    {
+      cond_.wait(lock, [this] {return !queue_.empty() || !running_;});
+
+      // Queued commands are completed before stopping.
+      if (queue_.empty())
+        {
+          return;
+        }
+
+      Entry entry = queue_.front();
+      queue_.pop_front();
+      busy_ = true;
+
+      lock.unlock();
+
+      try
+        {
+          entry.command();
+        }
+      catch (const std::exception &e)
+        {
+          BOOST_LOG_TRIVIAL (error) << "Device command " << entry.key << " failed: " << e.what();
+          error_handler_("Error in device command " + entry.key + ": " + e.what());
+        }
+
+      latency_.record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - entry.submitted).count());
+
+      lock.lock();
+
+      busy_ = false;
+      idle_cond_.notify_all();
+    }
+}
@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "frame_batcher.hpp"
+
+#include <i3ds/message.hpp>
+
+#include <asn1crt.h>
+
+// Upper bound of encoded size per pixel and per frame. A distance as a PER
+// real is a length byte, a header byte, up to 2 exponent bytes and up to 7
+// mantissa bytes, and validity is 2 bits.
+static const size_t bytes_per_distance = 11;
+static const size_t bits_per_validity = 2;
+static const size_t bytes_per_frame = 64;
+
+i3ds::FrameBatcher::FrameBatcher(NodeID node, int max_frames, int64_t max_latency)
+  : node_(node),
+    max_frames_(max_frames),
+    max_latency_(max_latency),
+    buffer_(ToFCamera::MeasurementTopic::Codec::max_size)
+{
+  ends_.reserve(max_frames);
+  timestamps_.reserve(max_frames);
+}
+
+bool
+i3ds::FrameBatcher::Fits(int pixels) const
+{
+  const size_t used = ends_.empty() ? 0 : ends_.back();
+
+  const size_t bytes = pixels * bytes_per_distance + (pixels * bits_per_validity + 7) / 8 + bytes_per_frame;
+
+  return used + bytes <= buffer_.size();
+}
+
+bool
+i3ds::FrameBatcher::Add(const ToFCamera::MeasurementTopic::Data &frame)
+{
+  const size_t used = ends_.empty() ? 0 : ends_.back();
+
+  BitStream stream;
+  BitStream_Init(&stream, buffer_.data() + used, buffer_.size() - used);
+
+  int error = 0;
+
+  if (!ToFCamera::MeasurementTopic::Codec::Encode(&frame, &stream, &error, true))
+    {
+      return false;
+    }
+
+  ends_.push_back(used + BitStream_GetLength(&stream));
+  timestamps_.push_back(frame.attributes.timestamp);
+
+  return true;
+}
+
+bool
+i3ds::FrameBatcher::Due(Timepoint now, int64_t period) const
+{
+  if (timestamps_.empty())
+    {
+      return false;
+    }
+
+  return (int) timestamps_.size() >= max_frames_ || now + period - timestamps_.front() > max_latency_;
+}
+
+void
+i3ds::FrameBatcher::Flush(Publisher &publisher)
+{
+  if (ends_.empty())
+    {
+      return;
+    }
+
+  Message message;
+  message.set_address(Address(node_, ToFCamera::MeasurementTopic::id));
+
+  size_t start = 0;
+
+  for (size_t end : ends_)
+    {
+      message.append_payload(buffer_.data() + start, end - start);
+      start = end;
+    }
+
+  publisher.Send(message);
+
+  ends_.clear();
+  timestamps_.clear();
+}
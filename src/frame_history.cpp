@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "frame_history.hpp"
+
+#include <algorithm>
+#include <vector>
+
+i3ds::FrameHistory::FrameHistory(size_t budget, size_t max_pixels)
+  : max_pixels_(max_pixels),
+    slots_((int) std::max<size_t>(budget / (sizeof(Slot) + 2 * max_pixels * sizeof(uint16_t)), 1)),
+    slot_(new Slot[slots_]),
+    planes_(new uint16_t[2 * max_pixels * slots_]()),
+    latest_(0)
+{
+  for (int i = 0; i < slots_; i++)
+    {
+      slot_[i].seq = 0;
+    }
+}
+
+uint16_t *
+i3ds::FrameHistory::depth(uint64_t frame) const
+{
+  return planes_.get() + 2 * max_pixels_ * (frame % slots_);
+}
+
+uint16_t *
+i3ds::FrameHistory::confidence(uint64_t frame) const
+{
+  return depth(frame) + max_pixels_;
+}
+
+void
+i3ds::FrameHistory::Store(const ToFRecordHeader &header, const uint16_t *depth, const uint16_t *confidence)
+{
+  const size_t size = (size_t) header.width * header.height;
+
+  if (size > max_pixels_)
+    {
+      return;
+    }
+
+  const uint64_t frame = latest_.load(std::memory_order_relaxed) + 1;
+
+  Slot &s = slot_[frame % slots_];
+
+  s.seq.store(2 * frame - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  s.header = header;
+  std::copy(depth, depth + size, this->depth(frame));
+  std::copy(confidence, confidence + size, this->confidence(frame));
+
+  s.seq.store(2 * frame, std::memory_order_release);
+  latest_.store(frame, std::memory_order_release);
+}
+
+i3ds::FrameHistory::DumpResult
+i3ds::FrameHistory::Dump(const std::string &path, int64_t from, int64_t to) const
+{
+  DumpResult result = {0, 0};
+
+  FILE *file = fopen(path.c_str(), "wb");
+
+  if (!file)
+    {
+      result.written = -1;
+      return result;
+    }
+
+  const uint64_t latest = latest_.load(std::memory_order_acquire);
+  const uint64_t first = latest > (uint64_t) slots_ ? latest - slots_ + 1 : 1;
+
+  ToFRecordHeader header;
+  std::vector<uint16_t> depth(max_pixels_), confidence(max_pixels_);
+
+  for (uint64_t frame = first; frame <= latest; frame++)
+    {
+      const Slot &s = slot_[frame % slots_];
+
+      if (s.seq.load(std::memory_order_acquire) != 2 * frame)
+        {
+          result.dropped++;
+          continue;
+        }
+
+      header = s.header;
+
+      // Intensity is not kept. Size is bounded in case the header was torn.
+      header.flags = 0;
+
+      const size_t size = std::min((size_t) header.width * header.height, max_pixels_);
+
+      std::copy(this->depth(frame), this->depth(frame) + size, depth.begin());
+      std::copy(this->confidence(frame), this->confidence(frame) + size, confidence.begin());
+
+      // Skipped if overwritten while copied.
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      if (s.seq.load(std::memory_order_relaxed) != 2 * frame)
+        {
+          result.dropped++;
+          continue;
+        }
+
+      if (header.timestamp < from || header.timestamp > to)
+        {
+          continue;
+        }
+
+      if (!write_record(file, header, depth.data(), confidence.data(), nullptr))
+        {
+          result.written = -1;
+          break;
+        }
+
+      result.written++;
+    }
+
+  if (fclose(file) != 0)
+    {
+      result.written = -1;
+    }
+
+  return result;
+}
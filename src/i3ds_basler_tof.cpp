@@ -9,6 +9,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <csignal>
+#include <cstdio>
 #include <iostream>
 #include <unistd.h>
 #include <string>
@@ -18,6 +19,7 @@
 #include <boost/program_options.hpp>
 
 #include "basler_tof_camera.hpp"
+#include "trace_ring.hpp"
 
 #define BOOST_LOG_DYN_LINK
 
@@ -35,6 +37,8 @@ namespace logging = boost::log;
 
 
 volatile bool running;
+volatile sig_atomic_t dump_trace;
+volatile sig_atomic_t dump_history;
 
 void signal_handler(int signum)
 {
@@ -42,11 +46,28 @@ void signal_handler(int signum)
   running = false;
 }
 
+// Trace is written from the main loop, not in signal context.
+void trace_handler(int signum)
+{
+  dump_trace = 1;
+}
+
+void history_handler(int signum)
+{
+  dump_history = 1;
+}
+
 
 
 int main(int argc, char **argv)
 {
   unsigned int node_id, trigger_node_id;;
+  std::vector<std::string> streams;
+  std::string trace_file;
+  std::string undistort, lens_file;
+  std::string thermal_file;
+  std::string history_file;
+  int history_window;
   i3ds::BaslerToFCamera::Parameters param;
 
   po::options_description desc("Allowed camera control options");
@@ -63,6 +84,81 @@ int main(int argc, char **argv)
    "Trigger output for ToF-camera.")
   ("trigger-camera-offset", po::value<TriggerOffset>(&param.camera_offset)->default_value(5000),
    "Trigger offset for ToF-camera (us).")
+  ("publish-period", po::value<SamplePeriod>(&param.publish_period)->default_value(0),
+   "Minimum period between published frames (us). Default publish every frame.")
+  ("latest-only", po::bool_switch(&param.latest_only),
+   "Publish from a separate thread, always the latest frame, stale frames are discarded.")
+  ("stream", po::value<std::vector<std::string>>(&streams)->composing(),
+   "Additional output stream as NODE:LEVEL:DIVIDER, publishing every DIVIDER frame at 1/2^LEVEL resolution.")
+  ("telemetry-node", po::value<NodeID>(&param.telemetry_node)->default_value(0),
+   "Node ID for telemetry, default is camera node ID + 1.")
+  ("telemetry-period", po::value<int>(&param.telemetry_period)->default_value(0),
+   "Period of telemetry (ms). Default disabled.")
+  ("temperature-period", po::value<int>(&param.temperature_period)->default_value(1000),
+   "Period of polling camera temperature and link status (ms).")
+  ("limits-period", po::value<int>(&param.limits_period)->default_value(5000),
+   "Period of polling depth limits and processing mode (ms).")
+  ("shm-slots", po::value<int>(&param.shm_slots)->default_value(0),
+   "Slots in shared memory frame ring for local consumers. Default disabled.")
+  ("shm-only", po::bool_switch(&param.shm_only),
+   "Publish frames to the shared memory ring only.")
+  ("direct-encoding", po::bool_switch(&param.direct_encoding),
+   "Encode frames straight from the camera buffers, after checking the output against the codec.")
+  ("intensity", po::bool_switch(&param.intensity), "Enable intensity component, published as a 16 bit mono image.")
+  ("intensity-node", po::value<NodeID>(&param.intensity_node)->default_value(0),
+   "Node ID for intensity images, default is camera node ID + 2.")
+  ("min-intensity", po::value<int>(&param.min_intensity)->default_value(0),
+   "Depth of pixels with lower intensity is invalid, requires --intensity. Default disabled.")
+  ("min-valid-depth", po::value<double>(&param.min_valid)->default_value(0.0),
+   "Distances shorter than this are invalid (m).")
+  ("max-valid-depth", po::value<double>(&param.max_valid)->default_value(0.0),
+   "Distances longer than this are invalid (m). Default disabled.")
+  ("change-threshold", po::value<double>(&param.change_threshold)->default_value(0.0),
+   "Mean depth change of a 16x16 tile for it to count as changed (m). Default publish all frames.")
+  ("change-fraction", po::value<double>(&param.change_fraction)->default_value(0.0),
+   "Fraction of tiles that must change for a frame to be published. Default any tile.")
+  ("keyframe-period", po::value<int>(&param.keyframe_period)->default_value(1000),
+   "Maximum period between full frames when change gated (ms).")
+  ("change-region", po::bool_switch(&param.change_region),
+   "Publish only the region of changed tiles between full frames. Not with --latest-only, "
+   "shared memory always gets full frames.")
+  ("auto-range", po::bool_switch(&param.auto_range),
+   "Adapt depth range to the scene while sampling, starting from the range set.")
+  ("auto-range-period", po::value<int>(&param.auto_range_period)->default_value(30),
+   "Frames between depth range adaptations.")
+  ("batch", po::value<int>(&param.batch_frames)->default_value(0),
+   "Publish frames in batches of this many per message on the batch node, instead of one per message.")
+  ("batch-node", po::value<NodeID>(&param.batch_node)->default_value(0),
+   "Node ID for batches, default is camera node ID + 3.")
+  ("batch-latency", po::value<int>(&param.batch_latency)->default_value(10000),
+   "Maximum time from the first frame in a batch until it is sent (us).")
+  ("normals", po::value<int>(&param.normals_stride)->default_value(0),
+   "Publish surface normals and planarity at every n-th pixel, zero disables. "
+   "Sent as four int16 mono images: nx, ny, nz and planarity, scaled by 32767.")
+  ("normals-radius", po::value<int>(&param.normals_radius)->default_value(3),
+   "Radius of the window for each surface normal (pixels).")
+  ("normals-threads", po::value<int>(&param.normals_threads)->default_value(2),
+   "Threads for surface normals, each takes a band of rows.")
+  ("normals-node", po::value<NodeID>(&param.normals_node)->default_value(0),
+   "Node ID for surface normals, default is camera node ID + 4.")
+  ("fov-x", po::value<double>(&param.fov_x)->default_value(57.0),
+   "Horizontal field of view of the full sensor (deg).")
+  ("fov-y", po::value<double>(&param.fov_y)->default_value(43.0),
+   "Vertical field of view of the full sensor (deg).")
+  ("undistort", po::value<std::string>(&undistort)->default_value("none"),
+   "Remap frames to an ideal pinhole camera: none, nearest or bilinear.")
+  ("lens-calibration", po::value<std::string>(&lens_file),
+   "Lens model for --undistort, lines of \"name = value\" for fx, fy, cx, cy, k1, k2, k3, p1 and p2.")
+  ("trace-file", po::value<std::string>(&trace_file)->default_value("/tmp/i3ds-basler-tof.trace"),
+   "File the frame trace is written to on SIGUSR1, decode with i3ds-basler-tof-trace.")
+  ("thermal-calibration", po::value<std::string>(&thermal_file),
+   "Depth correction for temperature, lines of \"temperature offset scale\" in Celsius and meters.")
+  ("history", po::value<int>(&param.history_budget)->default_value(0),
+   "Memory for raw frame history (MB), zero disables.")
+  ("history-window", po::value<int>(&history_window)->default_value(5000),
+   "Time before SIGUSR2 dumped from the history (ms).")
+  ("history-file", po::value<std::string>(&history_file)->default_value("/tmp/i3ds-basler-tof-history"),
+   "Prefix of the recordings dumped from the history on SIGUSR2, convert with i3ds-basler-tof-convert.")
   ("verbose,v", "Print verbose output")
   ("quiet,q", "Quiet ouput")
   ("print,p", "Print the camera configuration");
@@ -87,8 +183,148 @@ int main(int argc, char **argv)
 
   po::notify(vm);
 
+  if (param.min_intensity < 0 || param.min_intensity > 65535 || (param.min_intensity > 0 && !param.intensity))
+    {
+      std::cerr << "--min-intensity must be in 0-65535 and requires --intensity" << std::endl;
+      return -1;
+    }
+
+  if (param.change_threshold < 0.0 || param.change_fraction < 0.0 || param.change_fraction > 1.0)
+    {
+      std::cerr << "--change-threshold must be positive and --change-fraction in 0-1" << std::endl;
+      return -1;
+    }
+
+  // A dropped delta would leave the image of the receiver wrong until the
+  // next keyframe.
+  if (param.change_region && param.latest_only)
+    {
+      std::cerr << "--change-region can not be used with --latest-only" << std::endl;
+      return -1;
+    }
+
+  if (param.auto_range && param.auto_range_period < 1)
+    {
+      std::cerr << "--auto-range-period must be at least 1" << std::endl;
+      return -1;
+    }
+
+  if (param.batch_frames > 1 && param.batch_latency < 1)
+    {
+      std::cerr << "--batch-latency must be positive" << std::endl;
+      return -1;
+    }
+
+  if (undistort == "none")
+    {
+      param.undistort = i3ds::undistort_none;
+    }
+  else if (undistort == "nearest")
+    {
+      param.undistort = i3ds::undistort_nearest;
+    }
+  else if (undistort == "bilinear")
+    {
+      param.undistort = i3ds::undistort_bilinear;
+    }
+  else
+    {
+      std::cerr << "Invalid --undistort " << undistort << ", expected none, nearest or bilinear" << std::endl;
+      return -1;
+    }
+
+  if (param.undistort != i3ds::undistort_none)
+    {
+      if (lens_file.empty())
+        {
+          std::cerr << "--undistort requires --lens-calibration" << std::endl;
+          return -1;
+        }
+
+      try
+        {
+          param.lens = i3ds::read_lens_model(lens_file);
+        }
+      catch (const std::exception &e)
+        {
+          std::cerr << e.what() << std::endl;
+          return -1;
+        }
+    }
+
+  if (!thermal_file.empty())
+    {
+      if (param.temperature_period <= 0)
+        {
+          std::cerr << "--thermal-calibration requires a positive --temperature-period" << std::endl;
+          return -1;
+        }
+
+      try
+        {
+          param.thermal_table = i3ds::read_thermal_table(thermal_file);
+        }
+      catch (const std::exception &e)
+        {
+          std::cerr << e.what() << std::endl;
+          return -1;
+        }
+    }
+
+  if (param.history_budget < 0 || history_window < 1)
+    {
+      std::cerr << "--history must not be negative and --history-window must be positive" << std::endl;
+      return -1;
+    }
+
+  if (param.normals_stride < 0 || param.normals_radius < 1 || param.normals_threads < 1)
+    {
+      std::cerr << "--normals must not be negative, --normals-radius and --normals-threads at least 1" << std::endl;
+      return -1;
+    }
+
+  if (param.shm_only && param.shm_slots == 0)
+    {
+      std::cerr << "--shm-only requires --shm-slots" << std::endl;
+      return -1;
+    }
+
+  for (const std::string &stream : streams)
+    {
+      i3ds::BaslerToFCamera::StreamParameters p;
+
+      if (sscanf(stream.c_str(), "%u:%d:%d", &p.node, &p.level, &p.divider) != 3 ||
+          p.level < 0 || p.level > 4 || p.divider < 1)
+        {
+          std::cerr << "Invalid stream " << stream << ", expected NODE:LEVEL:DIVIDER with LEVEL 0-4" << std::endl;
+          return -1;
+        }
+
+      param.streams.push_back(p);
+    }
+
   BOOST_LOG_TRIVIAL(info) << "Using node ID: " << node_id;
 
+  if (param.telemetry_node == 0)
+    {
+      param.telemetry_node = node_id + 1;
+    }
+
+  if (param.intensity_node == 0)
+    {
+      param.intensity_node = node_id + 2;
+    }
+
+  if (param.batch_node == 0)
+    {
+      param.batch_node = node_id + 3;
+    }
+
+  if (param.normals_node == 0)
+    {
+      param.normals_node = node_id + 4;
+    }
+
   i3ds::Context::Ptr context = i3ds::Context::Create();;
 
   i3ds::Server server(context);
@@ -105,13 +341,52 @@ int main(int argc, char **argv)
   camera.Attach(server);
 
   running = true;
+  dump_trace = 0;
+  dump_history = 0;
   signal(SIGINT, signal_handler);
+  signal(SIGUSR1, trace_handler);
+  signal(SIGUSR2, history_handler);
+
+  int history_dumps = 0;
 
   server.Start();
 
   while (running)
     {
       sleep(1);
+
+      if (dump_trace)
+        {
+          dump_trace = 0;
+
+          const long events = i3ds::TraceRing::Global().Dump(trace_file);
+
+          if (events < 0)
+            {
+              BOOST_LOG_TRIVIAL(error) << "Failed to write trace to " << trace_file;
+            }
+          else
+            {
+              BOOST_LOG_TRIVIAL(info) << "Wrote " << events << " trace events to " << trace_file;
+            }
+        }
+
+      if (dump_history)
+        {
+          dump_history = 0;
+
+          const std::string path = history_file + "-" + std::to_string(history_dumps++) + ".rec";
+          const long frames = camera.dump_history(path, history_window);
+
+          if (frames < 0)
+            {
+              BOOST_LOG_TRIVIAL(error) << "Failed to write history to " << path;
+            }
+          else
+            {
+              BOOST_LOG_TRIVIAL(info) << "Wrote " << frames << " frames of history to " << path;
+            }
+        }
     }
 
   server.Stop();
@@ -0,0 +1,238 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <asn1crt.h>
+
+#include "tof_conversion.hpp"
+#include "tof_pipeline.hpp"
+#include "tof_wire_encoder.hpp"
+
+namespace po = boost::program_options;
+
+typedef i3ds::ToFCamera::MeasurementTopic::Data Measurement;
+
+// Benchmarks of the per-frame processing of the ToF node on synthetic frames.
+
+struct Frames
+{
+  Frames(int width, int height)
+    : width(width), height(height), depth(width * height), confidence(width * height), intensity(width * height)
+  {
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> value(0, 65535);
+
+    for (int i = 0; i < width * height; i++)
+      {
+        depth[i] = (uint16_t) value(random);
+        confidence[i] = (uint16_t) (value(random) < 6000 ? 0 : value(random));
+        intensity[i] = (uint16_t) value(random);
+      }
+  }
+
+  int width;
+  int height;
+  std::vector<uint16_t> depth;
+  std::vector<uint16_t> confidence;
+  std::vector<uint16_t> intensity;
+};
+
+// Runs the function, returns average time per iteration in milliseconds.
+static double
+run(int iterations, std::function<void()> f)
+{
+  f();
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < iterations; i++)
+    {
+      f();
+    }
+
+  const auto end = std::chrono::steady_clock::now();
+
+  return 1.0e-3 * std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / iterations;
+}
+
+static void
+report(const std::string &name, double ms, const Frames &frames)
+{
+  const double mpixels = 1.0e-6 * frames.width * frames.height;
+
+  std::cout << "  " << std::setw(28) << std::left << name << std::right
+            << std::fixed << std::setprecision(3) << std::setw(9) << ms << " ms/frame "
+            << std::setprecision(1) << std::setw(8) << mpixels / (1.0e-3 * ms) << " Mpixel/s" << std::endl;
+}
+
+static void
+convert(const Frames &frames, const i3ds::DepthScale &scale, Measurement &frame)
+{
+  const int size = frames.width * frames.height;
+
+  frame.region.offset_x = 0;
+  frame.region.offset_y = 0;
+  frame.region.size_x = (T_UInt16) frames.width;
+  frame.region.size_y = (T_UInt16) frames.height;
+  frame.distances.nCount = size;
+  frame.validity.nCount = size;
+
+  for (int i = 0; i < size; i++)
+    {
+      frame.distances.arr[i] = scale(frames.depth[i]);
+      frame.validity.arr[i] = i3ds::valid_depth(frames.depth[i], frames.confidence[i]) ? depth_valid : depth_range_error;
+    }
+
+  frame.attributes.timestamp = 0;
+  frame.attributes.validity = sample_valid;
+}
+
+// Codec path of send_sample against direct encoding from the raw planes.
+static bool
+bench_encoding(const Frames &frames, int iterations)
+{
+  const i3ds::DepthScale scale(0.5, 10.0);
+
+  std::unique_ptr<Measurement> frame(new Measurement);
+  i3ds::ToFCamera::MeasurementTopic::Codec::Initialize(*frame);
+
+  std::vector<byte> buffer(i3ds::ToFCamera::MeasurementTopic::Codec::max_size);
+
+  const double codec = run(iterations, [&]
+  {
+    convert(frames, scale, *frame);
+
+    BitStream stream;
+    BitStream_Init(&stream, buffer.data(), buffer.size());
+
+    int error;
+    i3ds::ToFCamera::MeasurementTopic::Codec::Encode(frame.get(), &stream, &error, true);
+  });
+
+  i3ds::ToFWireEncoder encoder;
+  const PlanarRegion region = frame->region;
+
+  const double direct = run(iterations, [&]
+  {
+    encoder.Encode(frames.depth.data(), frames.confidence.data(), region, scale, 0);
+  });
+
+  const bool identical = encoder.Matches(*frame);
+
+  std::cout << "Encoding " << frames.width << "x" << frames.height << ", " << encoder.size() << " bytes" << std::endl;
+  report("convert + codec", codec, frames);
+  report("direct encoding", direct, frames);
+  std::cout << "  output " << (identical ? "identical" : "DIFFERS") << std::endl;
+
+  return identical;
+}
+
+// One loop over the full image per stage against the tile-fused pipeline.
+static bool
+bench_pipeline(const Frames &frames, int iterations)
+{
+  const int size = frames.width * frames.height;
+
+  i3ds::ToFParameters p(i3ds::DepthScale(0.5, 10.0));
+  p.min_intensity = 1000;
+  p.min_valid = 1.0;
+  p.max_valid = 8.0;
+
+  std::vector<double> distances(size), fused_distances(size);
+  std::vector<uint8_t> valid(size);
+  std::vector<DepthValidity> validity(size), fused_validity(size);
+
+  const double unfused = run(iterations, [&]
+  {
+    for (int i = 0; i < size; i++)
+      {
+        distances[i] = p.scale(frames.depth[i]);
+      }
+
+    for (int i = 0; i < size; i++)
+      {
+        valid[i] = i3ds::valid_depth(frames.depth[i], frames.confidence[i]);
+      }
+
+    for (int i = 0; i < size; i++)
+      {
+        valid[i] &= frames.intensity[i] >= p.min_intensity;
+      }
+
+    for (int i = 0; i < size; i++)
+      {
+        valid[i] &= distances[i] >= p.min_valid && distances[i] <= p.max_valid;
+      }
+
+    for (int i = 0; i < size; i++)
+      {
+        validity[i] = valid[i] ? depth_valid : depth_range_error;
+      }
+  });
+
+  const i3ds::ToFPlanes planes = {frames.depth.data(), frames.confidence.data(), frames.intensity.data(), size};
+  const i3ds::ToFKernel<DepthValidity> kernel = i3ds::select_tof_kernel<DepthValidity>(true, true);
+
+  const double fused = run(iterations, [&]
+  {
+    kernel(planes, p, fused_distances.data(), fused_validity.data(), depth_valid, depth_range_error);
+  });
+
+  const bool identical = distances == fused_distances && validity == fused_validity;
+
+  std::cout << "Pipeline " << frames.width << "x" << frames.height
+            << ", scale, confidence, intensity and range stages" << std::endl;
+  report("unfused, loop per stage", unfused, frames);
+  report("fused, tiled", fused, frames);
+  std::cout << "  output " << (identical ? "identical" : "DIFFERS") << std::endl;
+
+  return identical;
+}
+
+int main(int argc, char **argv)
+{
+  int width, height, iterations;
+
+  po::options_description desc("Benchmark ToF frame processing");
+  desc.add_options()
+  ("help,h", "Produce this message")
+  ("width", po::value<int>(&width)->default_value(640), "Frame width")
+  ("height", po::value<int>(&height)->default_value(480), "Frame height")
+  ("iterations,i", po::value<int>(&iterations)->default_value(100), "Iterations per case");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return -1;
+    }
+
+  po::notify(vm);
+
+  const Frames frames(width, height);
+
+  bool ok = bench_pipeline(frames, iterations);
+
+  ok = bench_encoding(frames, iterations) && ok;
+
+  return ok ? 0 : 1;
+}
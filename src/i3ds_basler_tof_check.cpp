@@ -0,0 +1,303 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include <i3ds/time.hpp>
+#include <i3ds/subscriber.hpp>
+#include <i3ds/tof_camera_sensor.hpp>
+#include <i3ds/analog_sensor.hpp>
+
+#include "basler_tof_camera.hpp"
+#include "shm_frame_ring.hpp"
+
+namespace po = boost::program_options;
+
+typedef std::chrono::steady_clock Clock;
+
+// Subscriber side check of frame loss from i3ds-basler-tof. Frames received
+// are compared with the frames the node reports as published on telemetry,
+// together with the losses the node counts at each stage. With --shm the
+// camera frame IDs in the shared memory ring are checked for gaps instead,
+// not counting frames the node left out of the ring on purpose.
+
+volatile bool running;
+
+void signal_handler(int signum)
+{
+  running = false;
+}
+
+// Counters from a telemetry sample of the node.
+struct NodeCounters
+{
+  int64_t timestamp;
+  uint64_t published;
+  uint64_t decimated;
+  uint64_t unchanged;
+  uint64_t discarded;
+  uint64_t driver_gaps;
+  uint64_t grab_drops;
+};
+
+// Telemetry and frames received, updated by the subscriber.
+class Received
+{
+public:
+
+  Received() : samples_(0) {}
+
+  void Telemetry(const NodeCounters &counters)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    latest_ = counters;
+    samples_++;
+    cond_.notify_all();
+  }
+
+  // Frames are attributed to a telemetry sample by their timestamp, so
+  // the count is not skewed by telemetry lagging the frames.
+  void Frame(int64_t timestamp)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    timestamps_.push_back(timestamp);
+  }
+
+  // Wait for a telemetry sample after the samples seen, false if stopped.
+  bool Next(uint64_t &seen, NodeCounters &counters)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (running && samples_ <= seen)
+      {
+        cond_.wait_for(lock, std::chrono::milliseconds(100));
+      }
+
+    seen = samples_;
+    counters = latest_;
+
+    return samples_ > 0 && running;
+  }
+
+  // Frames received with timestamp in (from, to].
+  uint64_t Count(int64_t from, int64_t to)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::count_if(timestamps_.begin(), timestamps_.end(),
+                         [from, to](int64_t t) {return t > from && t <= to;});
+  }
+
+private:
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  NodeCounters latest_;
+  uint64_t samples_;
+  std::vector<int64_t> timestamps_;
+};
+
+static void
+check_shm(NodeID node, double duration, double report_period)
+{
+  i3ds::ShmFrameReader reader(i3ds::shm_ring_name(node));
+
+  uint64_t received = 0, gaps = 0;
+  i3ds::ShmFrameReader::Frame last = {};
+
+  const Clock::time_point end = Clock::now() + std::chrono::microseconds((int64_t) (duration * 1.0e6));
+  Clock::time_point next_report = Clock::now() + std::chrono::microseconds((int64_t) (report_period * 1.0e6));
+
+  std::cout << "time received camera_gaps reader_skipped" << std::endl;
+
+  while (running && Clock::now() < end)
+    {
+      i3ds::ShmFrameReader::Frame frame;
+
+      if (reader.Wait(100) && reader.Latest(frame))
+        {
+          // Frame IDs missing since the last frame read, less those the node
+          // left out of the ring and those written but skipped by this
+          // reader. Frame IDs may restart when grabbing is restarted.
+          if (last.frame > 0 && frame.sequence > last.sequence)
+            {
+              const int64_t missing = (int64_t) (frame.sequence - last.sequence - 1)
+                                      - (int64_t) (frame.omitted - last.omitted)
+                                      - (int64_t) (frame.frame - last.frame - 1);
+
+              gaps += missing > 0 ? missing : 0;
+            }
+
+          last = frame;
+          received++;
+        }
+
+      if (Clock::now() >= next_report)
+        {
+          std::cout << i3ds::get_timestamp() << " " << received << " " << gaps << " " << reader.Skipped() << std::endl;
+          next_report += std::chrono::microseconds((int64_t) (report_period * 1.0e6));
+        }
+    }
+
+  std::cout << std::endl
+            << "Received " << received << ", camera frame IDs missing " << gaps
+            << ", frames skipped by this reader " << reader.Skipped() << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  NodeID node, telemetry_node;
+  double duration, report_period;
+
+  po::options_description desc("Check frame loss of i3ds-basler-tof from the subscriber side");
+  desc.add_options()
+  ("help,h", "Produce this message")
+  ("node,n", po::value<NodeID>(&node)->default_value(12), "Node ID of camera")
+  ("telemetry-node", po::value<NodeID>(&telemetry_node)->default_value(0),
+   "Node ID of telemetry, default is camera node ID + 1. Telemetry must be enabled on the node.")
+  ("shm", "Check the shared memory ring instead of the network")
+  ("duration,d", po::value<double>(&duration)->default_value(60.0), "Duration of check (s)")
+  ("report", po::value<double>(&report_period)->default_value(5.0), "Report period (s)");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return -1;
+    }
+
+  po::notify(vm);
+
+  if (telemetry_node == 0)
+    {
+      telemetry_node = node + 1;
+    }
+
+  running = true;
+  signal(SIGINT, signal_handler);
+
+  if (vm.count("shm"))
+    {
+      check_shm(node, duration, report_period);
+      return 0;
+    }
+
+  Received received;
+
+  i3ds::Context::Ptr context = i3ds::Context::Create();
+  i3ds::Subscriber subscriber(context);
+
+  subscriber.Attach<i3ds::ToFCamera::MeasurementTopic>(node, [&](i3ds::ToFCamera::MeasurementTopic::Data &data)
+  {
+    received.Frame(data.attributes.timestamp);
+  });
+
+  subscriber.Attach<i3ds::Analog::MeasurementTopic>(telemetry_node, [&](i3ds::Analog::MeasurementTopic::Data &data)
+  {
+    typedef i3ds::BaslerToFCamera B;
+
+    if (data.samples.nCount < B::telemetry_samples)
+      {
+        return;
+      }
+
+    const float *s = data.samples.arr;
+    NodeCounters counters;
+
+    counters.timestamp = data.attributes.timestamp;
+    counters.published = s[B::telemetry_published];
+    counters.decimated = s[B::telemetry_decimated];
+    counters.unchanged = s[B::telemetry_unchanged];
+    counters.discarded = s[B::telemetry_discarded];
+    counters.driver_gaps = s[B::telemetry_driver_gaps];
+    counters.grab_drops = s[B::telemetry_grab_drops];
+
+    received.Telemetry(counters);
+  });
+
+  subscriber.Start();
+
+  // Losses are counted between two telemetry samples, from the first
+  // received to the first after the duration.
+  uint64_t seen = 0;
+  NodeCounters first, last;
+
+  if (!received.Next(seen, first))
+    {
+      subscriber.Stop();
+      return 0;
+    }
+
+  last = first;
+
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + std::chrono::microseconds((int64_t) (duration * 1.0e6));
+  Clock::time_point next_report = start + std::chrono::microseconds((int64_t) (report_period * 1.0e6));
+
+  std::cout << "time[s] received published network_lost[%] driver grab processing" << std::endl;
+
+  bool done = false;
+
+  while (!done && received.Next(seen, last))
+    {
+      done = Clock::now() >= end;
+
+      if (!done && Clock::now() < next_report)
+        {
+          continue;
+        }
+
+      next_report += std::chrono::microseconds((int64_t) (report_period * 1.0e6));
+
+      const uint64_t published = last.published - first.published;
+      const uint64_t got = received.Count(first.timestamp, last.timestamp);
+      const uint64_t lost = published > got ? published - got : 0;
+
+      std::cout << std::fixed << std::setprecision(1)
+                << 1.0e-6 * std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count() << " "
+                << got << " " << published << " "
+                << std::setprecision(3) << (published > 0 ? 100.0 * lost / published : 0.0) << " "
+                << last.driver_gaps - first.driver_gaps << " "
+                << last.grab_drops - first.grab_drops << " "
+                << last.discarded - first.discarded << std::endl;
+    }
+
+  // Frames sent just before the last sample may still be in transit.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  subscriber.Stop();
+
+  const uint64_t published = last.published - first.published;
+  const uint64_t got = received.Count(first.timestamp, last.timestamp);
+
+  std::cout << std::endl
+            << "Frames published " << published << ", received " << got
+            << ", lost in transport " << (published > got ? published - got : 0) << std::endl
+            << "Lost in node: driver " << last.driver_gaps - first.driver_gaps
+            << ", grab " << last.grab_drops - first.grab_drops
+            << ", processing " << last.discarded - first.discarded << std::endl
+            << "Not published by configuration: decimated " << last.decimated - first.decimated
+            << ", unchanged " << last.unchanged - first.unchanged << std::endl;
+
+  return 0;
+}
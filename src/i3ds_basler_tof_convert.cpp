@@ -0,0 +1,484 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "tof_conversion.hpp"
+#include "tof_pipeline.hpp"
+#include "tof_recording.hpp"
+
+namespace po = boost::program_options;
+
+typedef std::chrono::steady_clock Clock;
+
+// Converts recorded raw frames to metric depth images or point clouds, with
+// the same scaling and validity rules as the node. Frames are read as a
+// stream and converted in parallel, with a bounded number in flight.
+
+// Fixed pool of workers, each with its own queue. Idle workers steal from
+// the back of the other queues.
+class WorkStealingPool
+{
+public:
+
+  typedef std::function<void()> Task;
+
+  // At most capacity tasks are queued or running, submit blocks beyond.
+  WorkStealingPool(int workers, int capacity)
+    : capacity_(capacity), in_flight_(0), queued_(0), next_(0), stop_(false)
+  {
+    for (int i = 0; i < workers; i++)
+      {
+        queues_.emplace_back(new Queue);
+      }
+
+    for (int i = 0; i < workers; i++)
+      {
+        threads_.emplace_back(&WorkStealingPool::run, this, i);
+      }
+  }
+
+  ~WorkStealingPool()
+  {
+    wait();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+
+    work_cond_.notify_all();
+
+    for (std::thread &t : threads_)
+      {
+        t.join();
+      }
+  }
+
+  void submit(Task task)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      space_cond_.wait(lock, [this] {return in_flight_ < capacity_;});
+      in_flight_++;
+      queued_++;
+    }
+
+    Queue &queue = *queues_[next_++ % queues_.size()];
+
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+
+    work_cond_.notify_one();
+  }
+
+  // Wait for all submitted tasks to complete.
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_cond_.wait(lock, [this] {return in_flight_ == 0;});
+  }
+
+  uint64_t stolen() const {return stolen_;}
+
+private:
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool pop(int self, Task &task)
+  {
+    const int n = queues_.size();
+
+    for (int i = 0; i < n; i++)
+      {
+        Queue &queue = *queues_[(self + i) % n];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (queue.tasks.empty())
+          {
+            continue;
+          }
+
+        // Own queue from the front, others from the back.
+        if (i == 0)
+          {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+          }
+        else
+          {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            stolen_++;
+          }
+
+        return true;
+      }
+
+    return false;
+  }
+
+  void run(int self)
+  {
+    Task task;
+
+    while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+
+          work_cond_.wait(lock, [this] {return queued_ > 0 || stop_;});
+
+          if (queued_ == 0)
+            {
+              return;
+            }
+
+          queued_--;
+        }
+
+        // A task is reserved, it is in one of the queues.
+        while (!pop(self, task))
+          {
+            std::this_thread::yield();
+          }
+
+        task();
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          in_flight_--;
+        }
+
+        space_cond_.notify_all();
+      }
+  }
+
+  const int capacity_;
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable space_cond_;
+  int in_flight_;
+  int queued_;
+
+  unsigned int next_;
+  bool stop_;
+
+  std::atomic<uint64_t> stolen_{0};
+};
+
+// Writes converted frames to a single file in input order.
+class OrderedWriter
+{
+public:
+
+  OrderedWriter(FILE *file) : file_(file), next_(0), ok_(true) {}
+
+  void write(uint64_t index, std::vector<char> data)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    pending_[index] = std::move(data);
+
+    for (auto i = pending_.find(next_); i != pending_.end(); i = pending_.find(next_))
+      {
+        ok_ &= fwrite(i->second.data(), 1, i->second.size(), file_) == i->second.size();
+        pending_.erase(i);
+        next_++;
+      }
+  }
+
+  bool ok() const {return ok_;}
+
+private:
+
+  FILE *file_;
+  std::mutex mutex_;
+  std::map<uint64_t, std::vector<char>> pending_;
+  uint64_t next_;
+  bool ok_;
+};
+
+struct Options
+{
+  std::string format;
+  std::string output;
+
+  double min_valid;
+  double max_valid;
+  int min_intensity;
+
+  // Pinhole model of the full sensor, distance is along the ray.
+  double fov_x; // Degrees
+  double fov_y;
+  int sensor_width;
+  int sensor_height;
+};
+
+// Unit rays through the pixels of a region.
+static void
+make_rays(const Options &o, const i3ds::ToFRecordHeader &h, std::vector<float> &rays)
+{
+  const double fx = 0.5 * o.sensor_width / tan(0.5 * o.fov_x * M_PI / 180.0);
+  const double fy = 0.5 * o.sensor_height / tan(0.5 * o.fov_y * M_PI / 180.0);
+  const double cx = 0.5 * (o.sensor_width - 1);
+  const double cy = 0.5 * (o.sensor_height - 1);
+
+  rays.resize(3 * h.width * h.height);
+
+  for (int v = 0; v < h.height; v++)
+    {
+      for (int u = 0; u < h.width; u++)
+        {
+          const double x = (u + h.offset_x - cx) / fx;
+          const double y = (v + h.offset_y - cy) / fy;
+          const double n = 1.0 / sqrt(x * x + y * y + 1.0);
+
+          float *r = &rays[3 * (v * h.width + u)];
+
+          r[0] = (float) (x * n);
+          r[1] = (float) (y * n);
+          r[2] = (float) n;
+        }
+    }
+}
+
+static bool
+write_ply(const std::string &path, const std::vector<float> &rays, const double *distances,
+          const uint8_t *validity, int size)
+{
+  std::vector<float> points;
+  points.reserve(3 * size);
+
+  for (int i = 0; i < size; i++)
+    {
+      if (validity[i] == 0)
+        {
+          points.push_back((float) distances[i] * rays[3 * i]);
+          points.push_back((float) distances[i] * rays[3 * i + 1]);
+          points.push_back((float) distances[i] * rays[3 * i + 2]);
+        }
+    }
+
+  FILE *file = fopen(path.c_str(), "wb");
+
+  if (!file)
+    {
+      return false;
+    }
+
+  fprintf(file, "ply\nformat binary_little_endian 1.0\nelement vertex %zu\n"
+          "property float x\nproperty float y\nproperty float z\nend_header\n", points.size() / 3);
+
+  const bool ok = fwrite(points.data(), sizeof(float), points.size(), file) == points.size();
+
+  return fclose(file) == 0 && ok;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<std::string> inputs;
+  Options o;
+  int threads, in_flight;
+
+  po::options_description desc("Convert recorded ToF frames to depth images or point clouds");
+  desc.add_options()
+  ("help,h", "Produce this message")
+  ("input,i", po::value<std::vector<std::string>>(&inputs)->composing(), "Recording file, may be repeated")
+  ("output,o", po::value<std::string>(&o.output)->default_value("."),
+   "Output directory for ply, output file for binary")
+  ("format,f", po::value<std::string>(&o.format)->default_value("binary"),
+   "ply: point cloud per frame, binary: header, float64 distances and uint8 validity per frame, "
+   "0 for valid as in the shared memory ring")
+  ("threads,t", po::value<int>(&threads)->default_value(std::thread::hardware_concurrency()), "Worker threads")
+  ("in-flight", po::value<int>(&in_flight)->default_value(0), "Frames read ahead, default 4 per thread")
+  ("min-valid-depth", po::value<double>(&o.min_valid)->default_value(0.0), "Distances shorter are invalid (m)")
+  ("max-valid-depth", po::value<double>(&o.max_valid)->default_value(0.0), "Distances longer are invalid (m), zero is no limit")
+  ("min-intensity", po::value<int>(&o.min_intensity)->default_value(0), "Lower intensity is invalid, if recorded")
+  ("fov-x", po::value<double>(&o.fov_x)->default_value(57.0), "Horizontal field of view (deg)")
+  ("fov-y", po::value<double>(&o.fov_y)->default_value(43.0), "Vertical field of view (deg)")
+  ("sensor-width", po::value<int>(&o.sensor_width)->default_value(640), "Sensor width (pixels)")
+  ("sensor-height", po::value<int>(&o.sensor_height)->default_value(480), "Sensor height (pixels)");
+
+  po::positional_options_description positional;
+  positional.add("input", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+
+  if (vm.count("help") || !vm.count("input"))
+    {
+      std::cout << desc << std::endl;
+      return -1;
+    }
+
+  po::notify(vm);
+
+  const bool ply = o.format == "ply";
+
+  if (!ply && o.format != "binary")
+    {
+      std::cerr << "Unknown format " << o.format << std::endl;
+      return -1;
+    }
+
+  threads = std::max(threads, 1);
+  in_flight = in_flight > 0 ? in_flight : 4 * threads;
+
+  FILE *output = nullptr;
+
+  if (!ply && !(output = fopen(o.output.c_str(), "wb")))
+    {
+      std::cerr << "Cannot open " << o.output << std::endl;
+      return -1;
+    }
+
+  std::unique_ptr<OrderedWriter> writer(output ? new OrderedWriter(output) : nullptr);
+  std::atomic<uint64_t> failed(0);
+  uint64_t frames = 0, pixels = 0, stolen = 0;
+
+  const Clock::time_point start = Clock::now();
+
+  {
+    WorkStealingPool pool(threads, in_flight);
+
+    for (const std::string &input : inputs)
+      {
+        FILE *file = fopen(input.c_str(), "rb");
+
+        if (!file)
+          {
+            std::cerr << "Cannot open " << input << std::endl;
+            failed++;
+            continue;
+          }
+
+        std::shared_ptr<i3ds::ToFRecord> record(new i3ds::ToFRecord);
+
+        while (read_record(file, *record))
+          {
+            const uint64_t index = frames++;
+            pixels += record->depth.size();
+
+            pool.submit([record, index, ply, &o, &writer, &failed]()
+            {
+              const i3ds::ToFRecordHeader &h = record->header;
+              const int size = h.width * h.height;
+              const bool intensity_gate = o.min_intensity > 0 && !record->intensity.empty();
+              const bool range_gate = o.min_valid > 0.0 || o.max_valid > 0.0;
+
+              i3ds::ToFParameters p(i3ds::DepthScale(1.0e-3 * h.min_depth, 1.0e-3 * h.max_depth));
+              p.min_intensity = intensity_gate ? (uint16_t) o.min_intensity : 0;
+              p.min_valid = o.min_valid;
+              p.max_valid = o.max_valid;
+
+              const i3ds::ToFPlanes planes = {record->depth.data(), record->confidence.data(),
+                                              intensity_gate ? record->intensity.data() : nullptr, size
+                                             };
+
+              // Output buffers are kept per worker thread.
+              static thread_local std::vector<double> distances;
+              static thread_local std::vector<uint8_t> validity;
+              static thread_local std::vector<float> rays;
+              static thread_local i3ds::ToFRecordHeader ray_region = {};
+
+              if (ply)
+                {
+                  distances.resize(size);
+                  validity.resize(size);
+
+                  i3ds::select_tof_kernel<uint8_t>(intensity_gate, range_gate)
+                  (planes, p, distances.data(), validity.data(), 0, 1);
+
+                  if (h.width != ray_region.width || h.height != ray_region.height ||
+                      h.offset_x != ray_region.offset_x || h.offset_y != ray_region.offset_y)
+                    {
+                      make_rays(o, h, rays);
+                      ray_region = h;
+                    }
+
+                  char name[64];
+                  snprintf(name, sizeof(name), "/frame_%08lu.ply", (unsigned long) index);
+
+                  if (!write_ply(o.output + name, rays, distances.data(), validity.data(), size))
+                    {
+                      failed++;
+                    }
+                }
+              else
+                {
+                  // Converted straight into the buffer handed to the writer.
+                  std::vector<char> data(sizeof(h) + size * (sizeof(double) + sizeof(uint8_t)));
+
+                  double *d = (double *) (data.data() + sizeof(h));
+                  uint8_t *v = (uint8_t *) (d + size);
+
+                  memcpy(data.data(), &h, sizeof(h));
+
+                  i3ds::select_tof_kernel<uint8_t>(intensity_gate, range_gate)(planes, p, d, v, 0, 1);
+
+                  writer->write(index, std::move(data));
+                }
+            });
+
+            // The worker holds the last reference to the frame it converts.
+            record.reset(new i3ds::ToFRecord);
+          }
+
+        fclose(file);
+      }
+
+    pool.wait();
+    stolen = pool.stolen();
+  }
+
+  const double elapsed = 1.0e-6 * std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+
+  if (output && (!writer->ok() || fclose(output) != 0))
+    {
+      std::cerr << "Error writing " << o.output << std::endl;
+      failed++;
+    }
+
+  std::cout << std::fixed << std::setprecision(1)
+            << frames << " frames in " << elapsed << " s, "
+            << frames / elapsed << " frames/s, "
+            << 1.0e-6 * pixels / elapsed << " Mpixels/s on " << threads << " threads, "
+            << stolen << " frames stolen" << std::endl;
+
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,500 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdlib>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "basler_tof_grab_handler.hpp"
+#include "latency_histogram.hpp"
+#include "trigger_timeline.hpp"
+
+#define BOOST_LOG_DYN_LINK
+
+#include <boost/log/core.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/log/expressions.hpp>
+
+namespace po = boost::program_options;
+namespace logging = boost::log;
+
+using namespace GenTLConsumerImplHelper;
+
+typedef std::chrono::steady_clock Clock;
+
+// Soak test of the grab and error path. A scripted frame source stands in
+// for the camera and injects timeouts, disconnects, malformed part layouts
+// and bursts, while throughput, latency, memory and recovery are reported.
+// Errors are signalled as by the sampling loop when grabbing stops, and
+// each must be reported with the cause injected.
+// With --trigger-offset a stand-in trigger generator schedules the frames,
+// and the trigger latency measured by the node is checked against it.
+
+volatile bool running;
+
+// Faults the handler must report as errors.
+enum Cause
+{
+  cause_none,
+  cause_timeout,
+  cause_disconnect,
+  cause_malformed,
+  causes
+};
+
+// Part of the error message signalled for each cause.
+static const char *cause_message[causes] = {"", "timeouts", "Not connected", "Invalid configuration"};
+static const char *cause_name[causes] = {"unexpected", "timeout", "disconnect", "malformed"};
+
+void signal_handler(int signum)
+{
+  running = false;
+}
+
+// Resident set size in kilobytes.
+static long resident_kb()
+{
+  long pages = 0, resident = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+
+  if (statm)
+    {
+      if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        {
+          resident = 0;
+        }
+
+      fclose(statm);
+    }
+
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+int main(int argc, char **argv)
+{
+  double duration, rate, report_period;
+  int width, height, burst_length;
+  double p_timeout, p_disconnect, p_malformed, p_burst, p_missed;
+  int64_t trigger_offset, trigger_latency, trigger_jitter;
+  unsigned int seed;
+
+  po::options_description desc("Soak test of the ToF grab and error path");
+  desc.add_options()
+  ("help,h", "Produce this message")
+  ("duration,d", po::value<double>(&duration)->default_value(3600.0), "Duration of test (s)")
+  ("rate,r", po::value<double>(&rate)->default_value(30.0), "Frame rate (Hz)")
+  ("width", po::value<int>(&width)->default_value(640), "Frame width")
+  ("height", po::value<int>(&height)->default_value(480), "Frame height")
+  ("report", po::value<double>(&report_period)->default_value(10.0), "Report period (s)")
+  ("timeout", po::value<double>(&p_timeout)->default_value(0.01), "Probability of a run of timeouts per frame")
+  ("disconnect", po::value<double>(&p_disconnect)->default_value(0.0005), "Probability of disconnect per frame")
+  ("malformed", po::value<double>(&p_malformed)->default_value(0.0005), "Probability of malformed part layout per frame")
+  ("burst", po::value<double>(&p_burst)->default_value(0.005), "Probability of a burst per frame")
+  ("burst-length", po::value<int>(&burst_length)->default_value(15), "Frames in a burst, delivered back to back")
+  ("trigger-offset", po::value<int64_t>(&trigger_offset)->default_value(-1),
+   "Offset of stand-in trigger pulses (us). Default no trigger.")
+  ("trigger-latency", po::value<int64_t>(&trigger_latency)->default_value(2000), "Latency from pulse to frame (us)")
+  ("trigger-jitter", po::value<int64_t>(&trigger_jitter)->default_value(500), "Uniform jitter added to latency (us)")
+  ("missed", po::value<double>(&p_missed)->default_value(0.001), "Probability of a pulse without a frame")
+  ("seed", po::value<unsigned int>(&seed)->default_value(1), "Seed of fault script")
+  ("verbose,v", "Print verbose output");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return -1;
+    }
+
+  po::notify(vm);
+
+  if (!vm.count("verbose"))
+    {
+      logging::core::get()->set_filter(logging::trivial::severity >= logging::trivial::fatal);
+    }
+
+  const int size = width * height;
+
+  std::vector<uint16_t> depth(size), confidence(size);
+  std::vector<double> distances(size);
+  std::vector<bool> validity(size);
+
+  i3ds::LatencyHistogram latency;
+  Clock::time_point arrival;
+  double latency_sum = 0.0;
+
+  // Same work per pixel as the node does when converting a frame.
+  auto operation = [&](const uint16_t *d, const uint16_t *c, const uint16_t *, int w, int h, int, int)
+  {
+    const double KA = 1.0 / 65535.0;
+
+    for (int i = 0; i < w * h; i++)
+      {
+        distances[i] = KA * d[i];
+        validity[i] = d[i] != 0 && c[i] != 0;
+      }
+
+    const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - arrival).count();
+    latency.record(us);
+    latency_sum += us;
+
+    return true;
+  };
+
+  BaslerToFGrabHandler handler(operation);
+
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::uniform_int_distribution<int> timeout_run(1, 2 * BaslerToFGrabHandler::max_timeouts);
+  std::uniform_int_distribution<int64_t> jitter(0, std::max<int64_t>(trigger_jitter, 0));
+
+  BufferParts good(2);
+  good[0].partType = Range;
+  good[0].pData = depth.data();
+  good[0].width = width;
+  good[0].height = height;
+  good[1].partType = Confidence;
+  good[1].pData = confidence.data();
+  good[1].width = width;
+  good[1].height = height;
+
+  // Confidence part missing, as when a component is not enabled.
+  BufferParts malformed(good);
+  malformed.pop_back();
+
+  GrabResult ok, timeout;
+  ok.status = GrabResult::Ok;
+  timeout.status = GrabResult::Timeout;
+
+  const Clock::duration period = std::chrono::microseconds((int64_t) (1.0e6 / rate));
+  const bool triggered = trigger_offset >= 0;
+
+  i3ds::TriggerTimeline timeline;
+  int64_t slot = 0, first_fed = -1, last_fed = -1, fed = 0, injected_missed = 0, late = 0;
+  double trigger_sum = 0.0;
+
+  auto micros = [](Clock::time_point t)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+  };
+
+  running = true;
+  signal(SIGINT, signal_handler);
+
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point end = start + std::chrono::microseconds((int64_t) (duration * 1.0e6));
+
+  Clock::time_point next_frame = start;
+  Clock::time_point next_report = start + std::chrono::microseconds((int64_t) (report_period * 1.0e6));
+  Clock::time_point last_report = start;
+
+  uint64_t frames = 0, interval_frames = 0, frame_number = 0;
+  uint64_t injected_timeouts = 0, injected_disconnects = 0, injected_malformed = 0, injected_bursts = 0;
+  uint64_t errors = 0, recoveries = 0;
+  uint64_t expected[causes] = {}, detected[causes] = {}, misreported = 0;
+
+  int pending_timeouts = 0, pending_burst = 0, consecutive_timeouts = 0;
+
+  // Stand-in for the error state of the node.
+  std::string signalled;
+  Error_signaler error_signaler = [&](const std::string error_message, const bool)
+  {
+    signalled = error_message;
+  };
+
+  bool recovering = false;
+  Clock::time_point fault_start;
+  double recovery_sum = 0.0, recovery_max = 0.0;
+
+  double first_latency = -1.0;
+  const long first_rss = resident_kb();
+
+  handler.Reset();
+
+  if (triggered)
+    {
+      timeline.start(micros(start), std::chrono::duration_cast<std::chrono::microseconds>(period).count(), trigger_offset);
+    }
+
+  std::cout << "time[s] fps latency_mean[us] latency_p99[us] drift[us] rss[kB] growth[kB] "
+            << "errors recoveries recovery_mean[ms] recovery_max[ms]" << std::endl;
+
+  while (running && Clock::now() < end)
+    {
+      const bool in_burst = pending_burst > 0;
+
+      if (in_burst)
+        {
+          pending_burst--;
+        }
+      else if (triggered)
+        {
+          // Pulse without a frame, the slot is skipped.
+          if (uniform(random) < p_missed)
+            {
+              injected_missed++;
+              next_frame += period;
+              slot++;
+              continue;
+            }
+
+          std::this_thread::sleep_until(next_frame + std::chrono::microseconds(trigger_offset + trigger_latency + jitter(random)));
+        }
+      else
+        {
+          std::this_thread::sleep_until(next_frame);
+        }
+
+      next_frame += period;
+      slot++;
+
+      // Pick the next event from the script.
+      bool connected = true;
+      const GrabResult *result = &ok;
+      const BufferParts *parts = &good;
+
+      if (pending_timeouts > 0)
+        {
+          pending_timeouts--;
+          result = &timeout;
+        }
+      else
+        {
+          double p = uniform(random);
+
+          if (p < p_timeout)
+            {
+              pending_timeouts = timeout_run(random) - 1;
+              injected_timeouts++;
+              result = &timeout;
+            }
+          else if ((p -= p_timeout) < p_disconnect)
+            {
+              injected_disconnects++;
+              connected = false;
+            }
+          else if ((p -= p_disconnect) < p_malformed)
+            {
+              injected_malformed++;
+              parts = &malformed;
+            }
+          else if ((p -= p_malformed) < p_burst)
+            {
+              injected_bursts++;
+              pending_burst = burst_length;
+            }
+        }
+
+      // Cause the handler must report for this event, if any.
+      Cause cause = cause_none;
+
+      consecutive_timeouts = result == &timeout ? consecutive_timeouts + 1 : 0;
+
+      if (!connected)
+        {
+          cause = cause_disconnect;
+        }
+      else if (parts == &malformed)
+        {
+          cause = cause_malformed;
+        }
+      else if (consecutive_timeouts > BaslerToFGrabHandler::max_timeouts)
+        {
+          cause = cause_timeout;
+        }
+
+      expected[cause] += cause != cause_none;
+
+      if (result == &ok && parts == &good)
+        {
+          for (int i = 0; i < size; i += 64)
+            {
+              depth[i] = (uint16_t) (frame_number + i);
+              confidence[i] = (uint16_t) (i & 1);
+            }
+
+          frame_number++;
+        }
+      else if (!recovering)
+        {
+          recovering = true;
+          fault_start = Clock::now();
+        }
+
+      // Frame IDs follow the schedule, so skipped slots are driver gaps.
+      ok.frameId = slot;
+
+      arrival = Clock::now();
+
+      // Frames in a burst are queued, they are not measured against the pulses.
+      const bool measured = triggered && !in_burst && result == &ok && parts == &good && connected;
+
+      if (measured)
+        {
+          trigger_sum += timeline.arrival(micros(arrival));
+
+          // Delayed by the host past the next pulse, it is attributed to that.
+          if (arrival - (start + (slot - 1) * period) >= period)
+            {
+              late++;
+            }
+
+          if (first_fed < 0)
+            {
+              first_fed = slot;
+            }
+
+          last_fed = slot;
+          fed++;
+        }
+
+      if (!handler.Handle(*result, *parts, connected, 0, 0))
+        {
+          errors++;
+
+          // As when grabbing stops, then restarted after the error state.
+          signalled.clear();
+
+          if (!handler.SignalError(error_signaler))
+            {
+              misreported++;
+            }
+          else if (cause == cause_none)
+            {
+              detected[cause_none]++;
+            }
+          else if (signalled.find(cause_message[cause]) == std::string::npos)
+            {
+              misreported++;
+            }
+          else
+            {
+              detected[cause]++;
+            }
+
+          pending_timeouts = 0;
+          consecutive_timeouts = 0;
+          handler.Reset();
+        }
+      else if (result == &ok && parts == &good)
+        {
+          if (measured)
+            {
+              timeline.published(micros(arrival), micros(Clock::now()));
+            }
+
+          frames++;
+          interval_frames++;
+
+          if (recovering)
+            {
+              const double ms = 1.0e-3 * std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - fault_start).count();
+
+              recovery_sum += ms;
+              recovery_max = std::max(recovery_max, ms);
+              recoveries++;
+              recovering = false;
+            }
+        }
+
+      const Clock::time_point now = Clock::now();
+
+      if (now >= next_report)
+        {
+          const double elapsed = 1.0e-6 * std::chrono::duration_cast<std::chrono::microseconds>(now - last_report).count();
+          const i3ds::LatencyHistogram::Snapshot interval = latency.take();
+          const double mean = interval.total > 0 ? latency_sum / interval.total : 0.0;
+          const long rss = resident_kb();
+
+          if (first_latency < 0.0 && interval.total > 0)
+            {
+              first_latency = mean;
+            }
+
+          std::cout << std::fixed << std::setprecision(1)
+                    << 1.0e-6 * std::chrono::duration_cast<std::chrono::microseconds>(now - start).count() << " "
+                    << interval_frames / elapsed << " "
+                    << mean << " "
+                    << interval.percentile(0.99) << " "
+                    << (first_latency < 0.0 ? 0.0 : mean - first_latency) << " "
+                    << rss << " "
+                    << rss - first_rss << " "
+                    << errors << " "
+                    << recoveries << " "
+                    << std::setprecision(3)
+                    << (recoveries > 0 ? recovery_sum / recoveries : 0.0) << " "
+                    << recovery_max << std::endl;
+
+          latency_sum = 0.0;
+          interval_frames = 0;
+          last_report = now;
+          next_report += std::chrono::microseconds((int64_t) (report_period * 1.0e6));
+        }
+    }
+
+  std::cout << std::endl
+            << "Frames handled: " << frames << std::endl
+            << "Timeouts counted: " << handler.Timeouts() << std::endl
+            << "Frame ID gaps: " << handler.DriverGaps() << ", grab drops: " << handler.GrabDrops() << std::endl
+            << "Injected: " << injected_timeouts << " timeout runs, "
+            << injected_disconnects << " disconnects, "
+            << injected_malformed << " malformed, "
+            << injected_bursts << " bursts" << std::endl
+            << "Errors detected: " << errors << ", misreported " << misreported << std::endl;
+
+  // Every fault must be reported with its cause, and nothing else.
+  bool errors_ok = misreported == 0 && detected[cause_none] == 0;
+
+  for (int c = cause_timeout; c < causes; c++)
+    {
+      std::cout << "Errors by " << cause_name[c] << ": " << detected[c] << ", expected " << expected[c] << std::endl;
+
+      errors_ok &= detected[c] == expected[c];
+    }
+
+  if (detected[cause_none] > 0)
+    {
+      std::cout << "Errors not injected: " << detected[cause_none] << std::endl;
+    }
+
+  bool trigger_ok = true;
+
+  if (triggered && fed > 0)
+    {
+      const i3ds::TriggerTimeline::Snapshot t = timeline.take();
+      const int64_t expected_missed = last_fed - first_fed + 1 - fed;
+
+      std::cout << "Trigger latency mean " << trigger_sum / fed << " us, injected "
+                << trigger_latency << "-" << trigger_latency + trigger_jitter << " us" << std::endl
+                << "Trigger to frame p50/p99: " << t.grab.percentile(0.50) << "/" << t.grab.percentile(0.99)
+                << " us, to publish p50/p99: " << t.publish.percentile(0.50) << "/" << t.publish.percentile(0.99)
+                << " us, jitter " << t.jitter << " us" << std::endl
+                << "Missed pulses: " << t.missed << ", expected " << expected_missed
+                << " (" << injected_missed << " injected), " << late << " frames late" << std::endl;
+
+      // Every pulse without a measured frame must be counted as missed.
+      trigger_ok = std::abs((int64_t) t.missed - expected_missed) <= late;
+    }
+
+  return errors_ok && trigger_ok ? 0 : 1;
+}
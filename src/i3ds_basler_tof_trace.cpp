@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+#include "trace_ring.hpp"
+
+namespace po = boost::program_options;
+
+// Decodes a frame trace dumped by i3ds-basler-tof on SIGUSR1.
+int main(int argc, char **argv)
+{
+  std::string trace_file;
+
+  po::options_description desc("Decode frame trace of i3ds-basler-tof");
+  desc.add_options()
+  ("help,h", "Produce this message")
+  ("input,i", po::value<std::string>(&trace_file)->default_value("/tmp/i3ds-basler-tof.trace"), "Trace file")
+  ("summary,s", "Print only the summary");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help"))
+    {
+      std::cout << desc << std::endl;
+      return -1;
+    }
+
+  po::notify(vm);
+
+  FILE *file = fopen(trace_file.c_str(), "rb");
+
+  if (!file)
+    {
+      std::cerr << "Cannot open " << trace_file << std::endl;
+      return -1;
+    }
+
+  char magic[sizeof(i3ds::trace_magic)];
+  uint64_t count = 0;
+
+  if (fread(magic, sizeof(magic), 1, file) != 1 ||
+      memcmp(magic, i3ds::trace_magic, sizeof(magic)) != 0 ||
+      fread(&count, sizeof(count), 1, file) != 1)
+    {
+      std::cerr << trace_file << " is not a trace file" << std::endl;
+      fclose(file);
+      return -1;
+    }
+
+  std::vector<i3ds::TraceRecord> records(count);
+
+  if (count > 0 && fread(records.data(), sizeof(i3ds::TraceRecord), count, file) != count)
+    {
+      std::cerr << "Truncated trace file" << std::endl;
+      fclose(file);
+      return -1;
+    }
+
+  fclose(file);
+
+  const bool summary_only = vm.count("summary") > 0;
+
+  std::map<uint32_t, uint64_t> stage_count;
+  std::map<uint64_t, uint64_t> started;
+
+  uint64_t latency_count = 0;
+  double latency_sum = 0.0;
+  double latency_max = 0.0;
+
+  for (const i3ds::TraceRecord &r : records)
+    {
+      stage_count[r.stage]++;
+
+      if (!summary_only)
+        {
+          std::cout << std::setw(10) << r.seq << " "
+                    << std::fixed << std::setprecision(6) << 1.0e-9 * r.time << " "
+                    << std::setw(8) << r.frame << " "
+                    << std::setw(18) << std::left << i3ds::trace_stage_name(r.stage) << std::right << " "
+                    << r.arg << std::endl;
+        }
+
+      if (r.stage == i3ds::trace_sample_start)
+        {
+          started[r.frame] = r.time;
+        }
+      else if (r.stage == i3ds::trace_sample_published)
+        {
+          auto s = started.find(r.frame);
+
+          if (s != started.end())
+            {
+              const double latency = 1.0e-3 * (r.time - s->second);
+
+              latency_sum += latency;
+              latency_max = std::max(latency_max, latency);
+              latency_count++;
+
+              started.erase(s);
+            }
+        }
+    }
+
+  std::cout << std::endl << "Events: " << records.size() << std::endl;
+
+  if (!records.empty())
+    {
+      std::cout << "Time span: " << std::fixed << std::setprecision(3)
+                << 1.0e-9 * (records.back().time - records.front().time) << " s" << std::endl;
+    }
+
+  for (const auto &s : stage_count)
+    {
+      std::cout << "  " << std::setw(18) << std::left << i3ds::trace_stage_name(s.first) << std::right
+                << " " << s.second << std::endl;
+    }
+
+  if (latency_count > 0)
+    {
+      std::cout << "Sample to publish latency: mean " << std::setprecision(1) << latency_sum / latency_count
+                << " us, max " << latency_max << " us" << std::endl;
+    }
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "rate_governor.hpp"
+
+i3ds::RateGovernor::RateGovernor()
+  : period_(0), slack_(0), next_(0), admitted_(0), dropped_(0)
+{
+}
+
+void
+i3ds::RateGovernor::set_period(int64_t output_period, int64_t acquisition_period)
+{
+  period_ = output_period > 0 ? output_period : 0;
+  slack_ = acquisition_period > 0 ? acquisition_period / 2 : 0;
+
+  reset();
+}
+
+void
+i3ds::RateGovernor::reset()
+{
+  next_ = 0;
+}
+
+bool
+i3ds::RateGovernor::admit(int64_t now)
+{
+  if (period_ > 0 && next_ > 0 && now + slack_ < next_)
+    {
+      dropped_++;
+      return false;
+    }
+
+  // Keep to the schedule, but resynchronize after a gap in the input.
+  next_ = next_ > 0 ? next_ + period_ : now + period_;
+
+  if (next_ + slack_ <= now)
+    {
+      next_ = now + period_;
+    }
+
+  admitted_++;
+  return true;
+}
@@ -0,0 +1,272 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "shm_frame_ring.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char shm_magic[8] = {'I', '3', 'D', 'S', 'S', 'H', 'M', '1'};
+static const uint32_t shm_version = 3;
+
+static size_t
+slot_size(size_t max_pixels)
+{
+  const size_t size = sizeof(i3ds::ShmSlotHeader) + max_pixels * (sizeof(double) + sizeof(uint8_t));
+
+  // Keep slots cache line aligned.
+  return (size + 63) & ~((size_t) 63);
+}
+
+static size_t
+header_size()
+{
+  return (sizeof(i3ds::ShmRingHeader) + 63) & ~((size_t) 63);
+}
+
+std::string
+i3ds::shm_ring_name(uint32_t node)
+{
+  return "/i3ds-basler-tof-" + std::to_string(node);
+}
+
+i3ds::ShmFrameWriter::ShmFrameWriter(const std::string &name, int slots, size_t max_pixels)
+  : name_(name), frame_(0)
+{
+  if (slots < 2)
+    {
+      throw std::runtime_error("Shared memory ring needs at least two slots");
+    }
+
+  size_ = header_size() + slots * slot_size(max_pixels);
+
+  shm_unlink(name_.c_str());
+
+  const int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+  if (fd < 0)
+    {
+      throw std::runtime_error("Cannot create shared memory " + name_ + ": " + strerror(errno));
+    }
+
+  if (ftruncate(fd, size_) != 0)
+    {
+      close(fd);
+      shm_unlink(name_.c_str());
+      throw std::runtime_error("Cannot size shared memory " + name_ + ": " + strerror(errno));
+    }
+
+  void *memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (memory == MAP_FAILED)
+    {
+      shm_unlink(name_.c_str());
+      throw std::runtime_error("Cannot map shared memory " + name_ + ": " + strerror(errno));
+    }
+
+  // New pages are zero, so all slot sequences start out as empty.
+  header_ = static_cast<ShmRingHeader *>(memory);
+  header_->version = shm_version;
+  header_->slots = slots;
+  header_->slot_size = slot_size(max_pixels);
+  header_->max_pixels = max_pixels;
+  header_->latest = 0;
+  header_->wakeup = 0;
+
+  // Magic last, readers check it to see that the ring is initialized.
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header_->magic, shm_magic, sizeof(shm_magic));
+}
+
+i3ds::ShmFrameWriter::~ShmFrameWriter()
+{
+  munmap(header_, size_);
+  shm_unlink(name_.c_str());
+}
+
+i3ds::ShmSlotHeader *
+i3ds::ShmFrameWriter::slot(uint64_t frame)
+{
+  char *base = reinterpret_cast<char *>(header_) + header_size();
+  return reinterpret_cast<ShmSlotHeader *>(base + (frame % header_->slots) * header_->slot_size);
+}
+
+void
+i3ds::ShmFrameWriter::Begin(double **distances, uint8_t **validity)
+{
+  ShmSlotHeader *s = slot(++frame_);
+
+  s->seq.store(2 * frame_ - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  *distances = reinterpret_cast<double *>(s + 1);
+  *validity = reinterpret_cast<uint8_t *>(*distances + header_->max_pixels);
+}
+
+void
+i3ds::ShmFrameWriter::Commit(uint64_t sequence, uint64_t omitted, int64_t timestamp,
+                             uint16_t offset_x, uint16_t offset_y, uint16_t size_x, uint16_t size_y)
+{
+  ShmSlotHeader *s = slot(frame_);
+
+  s->frame = frame_;
+  s->sequence = sequence;
+  s->omitted = omitted;
+  s->timestamp = timestamp;
+  s->offset_x = offset_x;
+  s->offset_y = offset_y;
+  s->size_x = size_x;
+  s->size_y = size_y;
+
+  s->seq.store(2 * frame_, std::memory_order_release);
+  header_->latest.store(frame_, std::memory_order_release);
+
+  header_->wakeup.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, &header_->wakeup, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+i3ds::ShmFrameReader::ShmFrameReader(const std::string &name)
+  : last_(0), skipped_(0)
+{
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+
+  if (fd < 0)
+    {
+      throw std::runtime_error("Cannot open shared memory " + name + ": " + strerror(errno));
+    }
+
+  struct stat st;
+
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < header_size())
+    {
+      close(fd);
+      throw std::runtime_error("Shared memory " + name + " is not a frame ring");
+    }
+
+  size_ = st.st_size;
+
+  void *memory = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (memory == MAP_FAILED)
+    {
+      throw std::runtime_error("Cannot map shared memory " + name + ": " + strerror(errno));
+    }
+
+  header_ = static_cast<const ShmRingHeader *>(memory);
+
+  if (memcmp(header_->magic, shm_magic, sizeof(shm_magic)) != 0 || header_->version != shm_version ||
+      size_ < header_size() + header_->slots * header_->slot_size)
+    {
+      munmap(memory, size_);
+      throw std::runtime_error("Shared memory " + name + " is not a compatible frame ring");
+    }
+}
+
+i3ds::ShmFrameReader::~ShmFrameReader()
+{
+  munmap(const_cast<ShmRingHeader *>(header_), size_);
+}
+
+const i3ds::ShmSlotHeader *
+i3ds::ShmFrameReader::slot(uint64_t frame) const
+{
+  const char *base = reinterpret_cast<const char *>(header_) + header_size();
+  return reinterpret_cast<const ShmSlotHeader *>(base + (frame % header_->slots) * header_->slot_size);
+}
+
+bool
+i3ds::ShmFrameReader::Wait(int timeout_ms)
+{
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+  for (;;)
+    {
+      const int32_t wakeup = header_->wakeup.load(std::memory_order_acquire);
+
+      if (header_->latest.load(std::memory_order_acquire) > last_)
+        {
+          return true;
+        }
+
+      // Timeout is restarted on spurious wakeups, good enough for a reader.
+      if (syscall(SYS_futex, &header_->wakeup, FUTEX_WAIT, wakeup, &timeout, nullptr, 0) != 0 &&
+          errno == ETIMEDOUT)
+        {
+          return header_->latest.load(std::memory_order_acquire) > last_;
+        }
+    }
+}
+
+bool
+i3ds::ShmFrameReader::Latest(Frame &frame)
+{
+  for (;;)
+    {
+      const uint64_t latest = header_->latest.load(std::memory_order_acquire);
+
+      if (latest == 0)
+        {
+          return false;
+        }
+
+      const ShmSlotHeader *s = slot(latest);
+
+      if (s->seq.load(std::memory_order_acquire) != 2 * latest)
+        {
+          // Overwritten already, a newer frame is available.
+          continue;
+        }
+
+      frame.frame = latest;
+      frame.sequence = s->sequence;
+      frame.omitted = s->omitted;
+      frame.timestamp = s->timestamp;
+      frame.offset_x = s->offset_x;
+      frame.offset_y = s->offset_y;
+      frame.size_x = s->size_x;
+      frame.size_y = s->size_y;
+      frame.distances = reinterpret_cast<const double *>(s + 1);
+      frame.validity = reinterpret_cast<const uint8_t *>(frame.distances + header_->max_pixels);
+
+      if (!Valid(frame))
+        {
+          continue;
+        }
+
+      if (last_ > 0 && latest > last_ + 1)
+        {
+          skipped_ += latest - last_ - 1;
+        }
+
+      last_ = latest;
+
+      return true;
+    }
+}
+
+bool
+i3ds::ShmFrameReader::Valid(const Frame &frame) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot(frame.frame)->seq.load(std::memory_order_relaxed) == 2 * frame.frame;
+}
@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "thermal_compensation.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+i3ds::ThermalCompensation::ThermalCompensation(const std::vector<Entry> &table)
+  : table_(table)
+{
+}
+
+std::vector<i3ds::ThermalCompensation::Entry>
+i3ds::read_thermal_table(const std::string &path)
+{
+  std::vector<ThermalCompensation::Entry> table;
+  std::ifstream file(path);
+
+  if (!file)
+    {
+      throw std::runtime_error("Can not open thermal calibration " + path);
+    }
+
+  std::string line;
+  int number = 0;
+
+  while (std::getline(file, line))
+    {
+      number++;
+
+      const size_t first = line.find_first_not_of(" \t\r");
+
+      if (first == std::string::npos || line[first] == '#')
+        {
+          continue;
+        }
+
+      std::istringstream fields(line);
+      ThermalCompensation::Entry e;
+
+      if (!(fields >> e.temperature >> e.offset >> e.scale) || !(e.scale > 0.0))
+        {
+          throw std::runtime_error("Invalid thermal calibration " + path + " line " + std::to_string(number) +
+                                   ", expected temperature, offset and positive scale");
+        }
+
+      if (!table.empty() && !(e.temperature > table.back().temperature))
+        {
+          throw std::runtime_error("Invalid thermal calibration " + path + " line " + std::to_string(number) +
+                                   ", temperatures must be increasing");
+        }
+
+      table.push_back(e);
+    }
+
+  if (table.empty())
+    {
+      throw std::runtime_error("Empty thermal calibration " + path);
+    }
+
+  return table;
+}
+
+i3ds::ThermalCompensation::Entry
+i3ds::ThermalCompensation::at(double temperature) const
+{
+  if (!(temperature > table_.front().temperature))
+    {
+      return table_.front();
+    }
+
+  if (!(temperature < table_.back().temperature))
+    {
+      return table_.back();
+    }
+
+  // First entry above the temperature, there is one below it.
+  const auto upper = std::upper_bound(table_.begin(), table_.end(), temperature,
+                                      [](double t, const Entry & e) {return t < e.temperature;});
+  const Entry &a = *(upper - 1);
+  const Entry &b = *upper;
+  const double w = (temperature - a.temperature) / (b.temperature - a.temperature);
+
+  Entry e;
+  e.temperature = temperature;
+  e.offset = a.offset + w * (b.offset - a.offset);
+  e.scale = a.scale + w * (b.scale - a.scale);
+
+  return e;
+}
+
+i3ds::DepthScale
+i3ds::ThermalCompensation::apply(const DepthScale &scale, double temperature) const
+{
+  const Entry e = at(temperature);
+
+  // scale * (KA * depth + KB) + offset
+  DepthScale corrected = scale;
+  corrected.KA = e.scale * scale.KA;
+  corrected.KB = e.scale * scale.KB + e.offset;
+
+  return corrected;
+}
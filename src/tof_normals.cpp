@@ -0,0 +1,396 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tof_normals.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+i3ds::SurfaceNormals::SurfaceNormals(double fov_x, double fov_y, int radius, int stride, int threads)
+  : fov_x_(fov_x),
+    fov_y_(fov_y),
+    radius_(radius),
+    stride_(stride),
+    region_({0, 0, 0, 0}),
+    sensor_width_(0),
+    sensor_height_(0),
+    out_width_(0),
+    out_height_(0),
+    frame_(nullptr),
+    bands_(std::max(threads, 1)),
+    generation_(0),
+    pending_(0),
+    running_(true)
+{
+  for (int i = 1; i < (int) bands_.size(); i++)
+    {
+      workers_.emplace_back(&i3ds::SurfaceNormals::worker, this, i);
+    }
+}
+
+i3ds::SurfaceNormals::~SurfaceNormals()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_ = false;
+  }
+
+  start_cond_.notify_all();
+
+  for (std::thread &t : workers_)
+    {
+      t.join();
+    }
+}
+
+PlanarRegion
+i3ds::SurfaceNormals::region() const
+{
+  PlanarRegion r;
+
+  r.offset_x = (T_UInt16) (region_.offset_x / stride_);
+  r.offset_y = (T_UInt16) (region_.offset_y / stride_);
+  r.size_x = (T_UInt16) out_width_;
+  r.size_y = (T_UInt16) out_height_;
+
+  return r;
+}
+
+void
+i3ds::SurfaceNormals::update_rays(const PlanarRegion &region, int sensor_width, int sensor_height)
+{
+  if (region.offset_x == region_.offset_x && region.offset_y == region_.offset_y &&
+      region.size_x == region_.size_x && region.size_y == region_.size_y &&
+      sensor_width == sensor_width_ && sensor_height == sensor_height_)
+    {
+      return;
+    }
+
+  region_ = region;
+  sensor_width_ = sensor_width;
+  sensor_height_ = sensor_height;
+
+  const double fx = 0.5 * sensor_width / tan(0.5 * fov_x_ * M_PI / 180.0);
+  const double fy = 0.5 * sensor_height / tan(0.5 * fov_y_ * M_PI / 180.0);
+  const double cx = 0.5 * (sensor_width - 1);
+  const double cy = 0.5 * (sensor_height - 1);
+
+  rays_.resize(3 * region.size_x * region.size_y);
+
+  for (int v = 0; v < region.size_y; v++)
+    {
+      for (int u = 0; u < region.size_x; u++)
+        {
+          const double x = (u + region.offset_x - cx) / fx;
+          const double y = (v + region.offset_y - cy) / fy;
+          const double n = 1.0 / sqrt(x * x + y * y + 1.0);
+
+          float *r = &rays_[3 * (v * region.size_x + u)];
+
+          r[0] = (float) (x * n);
+          r[1] = (float) (y * n);
+          r[2] = (float) n;
+        }
+    }
+}
+
+void
+i3ds::SurfaceNormals::compute(const ToFCamera::MeasurementTopic::Data &frame, int sensor_width, int sensor_height)
+{
+  update_rays(frame.region, sensor_width, sensor_height);
+
+  out_width_ = frame.region.size_x / stride_;
+  out_height_ = frame.region.size_y / stride_;
+  output_.resize(channels * out_width_ * out_height_);
+
+  frame_ = &frame;
+
+  const int n = (int) bands_.size();
+
+  for (int b = 0; b < n; b++)
+    {
+      bands_[b].first = out_height_ * b / n;
+      bands_[b].last = out_height_ * (b + 1) / n;
+    }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    generation_++;
+    pending_ = (int) workers_.size();
+  }
+
+  start_cond_.notify_all();
+
+  run_band(bands_[0]);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this] {return pending_ == 0;});
+}
+
+void
+i3ds::SurfaceNormals::worker(int index)
+{
+  uint64_t seen = 0;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true)
+    {
+      start_cond_.wait(lock, [&] {return !running_ || generation_ != seen;});
+
+      if (!running_)
+        {
+          return;
+        }
+
+      seen = generation_;
+
+      lock.unlock();
+      run_band(bands_[index]);
+      lock.lock();
+
+      if (--pending_ == 0)
+        {
+          done_cond_.notify_one();
+        }
+    }
+}
+
+// Normal as the eigenvector of the smallest eigenvalue of the symmetric
+// covariance {xx, xy, xz, yy, yz, zz}, false if it is not defined.
+static bool
+smallest_eigenvector(const double c[6], double normal[3], double &smallest)
+{
+  const double trace = c[0] + c[3] + c[5];
+  const double q = trace / 3.0;
+  const double p1 = c[1] * c[1] + c[2] * c[2] + c[4] * c[4];
+  const double p2 = (c[0] - q) * (c[0] - q) + (c[3] - q) * (c[3] - q) + (c[5] - q) * (c[5] - q) + 2.0 * p1;
+
+  if (!(p2 > 0.0))
+    {
+      return false;
+    }
+
+  const double p = sqrt(p2 / 6.0);
+
+  // Determinant of (C - qI) / p, half of it is the cosine of 3 phi.
+  const double b00 = (c[0] - q) / p, b11 = (c[3] - q) / p, b22 = (c[5] - q) / p;
+  const double b01 = c[1] / p, b02 = c[2] / p, b12 = c[4] / p;
+  const double r = 0.5 * (b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) + b02 * (b01 * b12 - b11 * b02));
+  const double phi = acos(std::min(std::max(r, -1.0), 1.0)) / 3.0;
+
+  smallest = q + 2.0 * p * cos(phi + 2.0 * M_PI / 3.0);
+
+  // Rows of C - smallest I span the plane orthogonal to the eigenvector,
+  // the largest cross product of two rows is the most stable.
+  const double m[3][3] =
+  {
+    {c[0] - smallest, c[1], c[2]},
+    {c[1], c[3] - smallest, c[4]},
+    {c[2], c[4], c[5] - smallest}
+  };
+
+  double best = 0.0;
+
+  for (int i = 0; i < 3; i++)
+    {
+      const double *a = m[i];
+      const double *b = m[(i + 1) % 3];
+      const double v[3] = {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+      const double norm = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+
+      if (norm > best)
+        {
+          best = norm;
+          normal[0] = v[0];
+          normal[1] = v[1];
+          normal[2] = v[2];
+        }
+    }
+
+  if (!(best > 0.0))
+    {
+      return false;
+    }
+
+  const double s = 1.0 / sqrt(best);
+
+  normal[0] *= s;
+  normal[1] *= s;
+  normal[2] *= s;
+
+  return true;
+}
+
+void
+i3ds::SurfaceNormals::run_band(Band &band)
+{
+  if (band.first >= band.last)
+    {
+      return;
+    }
+
+  const ToFCamera::MeasurementTopic::Data &frame = *frame_;
+  const int width = frame.region.size_x;
+  const int height = frame.region.size_y;
+  const int half = stride_ / 2;
+
+  // Input rows covered by the windows of the band.
+  const int y0 = std::max(band.first * stride_ + half - radius_, 0);
+  const int y1 = std::min((band.last - 1) * stride_ + half + radius_ + 1, height);
+  const int rows = y1 - y0;
+
+  const int pitch = width + 1;
+  const int plane = (rows + 1) * pitch;
+
+  band.integral.resize(sums * plane + sums * width);
+
+  double *integral = band.integral.data();
+  double *values = integral + sums * plane;
+
+  for (int k = 0; k < sums; k++)
+    {
+      std::fill(integral + k * plane, integral + k * plane + pitch, 0.0);
+    }
+
+  for (int y = 0; y < rows; y++)
+    {
+      const double *distance = frame.distances.arr + (y0 + y) * width;
+      const DepthValidity *validity = frame.validity.arr + (y0 + y) * width;
+      const float *ray = rays_.data() + 3 * (y0 + y) * width;
+
+      double *one = values;
+
+      // Points of the row, zero where invalid, without branches. Each loop
+      // writes one plane, so it needs few alias checks and vectorizes.
+      for (int x = 0; x < width; x++)
+        {
+          one[x] = validity[x] == depth_valid ? 1.0 : 0.0;
+        }
+
+      for (int c = 0; c < 3; c++)
+        {
+          double *p = values + (1 + c) * width;
+          const float *r = ray + c;
+
+          for (int x = 0; x < width; x++)
+            {
+              p[x] = one[x] * distance[x] * r[3 * x];
+            }
+        }
+
+      // Products xx, xy, xz, yy, yz and zz.
+      static const int factors[6][2] = {{1, 1}, {1, 2}, {1, 3}, {2, 2}, {2, 3}, {3, 3}};
+
+      for (int k = 0; k < 6; k++)
+        {
+          const double *a = values + factors[k][0] * width;
+          const double *b = values + factors[k][1] * width;
+          double *p = values + (4 + k) * width;
+
+          for (int x = 0; x < width; x++)
+            {
+              p[x] = a[x] * b[x];
+            }
+        }
+
+      for (int k = 0; k < sums; k++)
+        {
+          const double *v = values + k * width;
+          const double *above = integral + k * plane + y * pitch;
+          double *row = integral + k * plane + (y + 1) * pitch;
+
+          double sum = 0.0;
+          row[0] = 0.0;
+
+          for (int x = 0; x < width; x++)
+            {
+              sum += v[x];
+              row[x + 1] = above[x + 1] + sum;
+            }
+        }
+    }
+
+  const int planes = out_width_ * out_height_;
+
+  for (int oy = band.first; oy < band.last; oy++)
+    {
+      const int cy = oy * stride_ + half;
+      const int ya = std::max(cy - radius_, y0) - y0;
+      const int yb = std::min(cy + radius_ + 1, y1) - y0;
+
+      int16_t *out = output_.data() + oy * out_width_;
+
+      for (int ox = 0; ox < out_width_; ox++, out++)
+        {
+          const int cx = ox * stride_ + half;
+          const int xa = std::max(cx - radius_, 0);
+          const int xb = std::min(cx + radius_ + 1, width);
+
+          out[0] = out[planes] = out[2 * planes] = out[3 * planes] = 0;
+
+          if (frame.validity.arr[cy * width + cx] != depth_valid)
+            {
+              continue;
+            }
+
+          double s[sums];
+
+          for (int k = 0; k < sums; k++)
+            {
+              const double *I = integral + k * plane;
+              s[k] = I[yb * pitch + xb] - I[ya * pitch + xb] - I[yb * pitch + xa] + I[ya * pitch + xa];
+            }
+
+          const double n = s[0];
+
+          if (n < 3.0 || 2.0 * n < (xb - xa) * (yb - ya))
+            {
+              continue;
+            }
+
+          const double mean[3] = {s[1] / n, s[2] / n, s[3] / n};
+          const double c[6] =
+          {
+            s[4] / n - mean[0] * mean[0],
+            s[5] / n - mean[0] * mean[1],
+            s[6] / n - mean[0] * mean[2],
+            s[7] / n - mean[1] * mean[1],
+            s[8] / n - mean[1] * mean[2],
+            s[9] / n - mean[2] * mean[2]
+          };
+
+          const double trace = c[0] + c[3] + c[5];
+
+          double normal[3];
+          double smallest;
+
+          if (!(trace > 0.0) || !smallest_eigenvector(c, normal, smallest))
+            {
+              continue;
+            }
+
+          // Camera is at the origin.
+          if (normal[0] * mean[0] + normal[1] * mean[1] + normal[2] * mean[2] > 0.0)
+            {
+              normal[0] = -normal[0];
+              normal[1] = -normal[1];
+              normal[2] = -normal[2];
+            }
+
+          const double planarity = std::min(std::max(1.0 - 3.0 * smallest / trace, 0.0), 1.0);
+
+          out[0] = (int16_t) lround(normal[0] * scale);
+          out[planes] = (int16_t) lround(normal[1] * scale);
+          out[2 * planes] = (int16_t) lround(normal[2] * scale);
+          out[3 * planes] = (int16_t) lround(planarity * scale);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tof_pyramid.hpp"
+
+void
+i3ds::pyramid_down(const ToFCamera::MeasurementTopic::Data &src, ToFCamera::MeasurementTopic::Data &dst)
+{
+  const int src_width = src.region.size_x;
+  const int width = src.region.size_x / 2;
+  const int height = src.region.size_y / 2;
+
+  dst.attributes = src.attributes;
+
+  dst.region.offset_x = src.region.offset_x / 2;
+  dst.region.offset_y = src.region.offset_y / 2;
+  dst.region.size_x = (T_UInt16) width;
+  dst.region.size_y = (T_UInt16) height;
+
+  dst.distances.nCount = width * height;
+  dst.validity.nCount = width * height;
+
+  for (int y = 0; y < height; y++)
+    {
+      const int row = 2 * y * src_width;
+
+      for (int x = 0; x < width; x++)
+        {
+          const int block[4] = {row + 2 * x, row + 2 * x + 1, row + src_width + 2 * x, row + src_width + 2 * x + 1};
+          const int i = y * width + x;
+
+          double sum = 0.0;
+          int valid = 0;
+
+          for (int k = 0; k < 4; k++)
+            {
+              if (src.validity.arr[block[k]] == depth_valid)
+                {
+                  sum += src.distances.arr[block[k]];
+                  valid++;
+                }
+            }
+
+          if (valid > 0)
+            {
+              dst.distances.arr[i] = sum / valid;
+              dst.validity.arr[i] = depth_valid;
+            }
+          else
+            {
+              dst.distances.arr[i] = src.distances.arr[block[0]];
+              dst.validity.arr[i] = depth_range_error;
+            }
+        }
+    }
+}
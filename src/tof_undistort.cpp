@@ -0,0 +1,305 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tof_undistort.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+i3ds::LensModel
+i3ds::read_lens_model(const std::string &path)
+{
+  LensModel lens;
+
+  po::options_description desc("Lens model");
+
+  desc.add_options()
+  ("fx", po::value<double>(&lens.fx)->required(), "Focal length (pixels)")
+  ("fy", po::value<double>(&lens.fy)->required(), "Focal length (pixels)")
+  ("cx", po::value<double>(&lens.cx)->required(), "Principal point (pixels)")
+  ("cy", po::value<double>(&lens.cy)->required(), "Principal point (pixels)")
+  ("k1", po::value<double>(&lens.k1)->default_value(0.0), "Radial distortion")
+  ("k2", po::value<double>(&lens.k2)->default_value(0.0), "Radial distortion")
+  ("k3", po::value<double>(&lens.k3)->default_value(0.0), "Radial distortion")
+  ("p1", po::value<double>(&lens.p1)->default_value(0.0), "Tangential distortion")
+  ("p2", po::value<double>(&lens.p2)->default_value(0.0), "Tangential distortion")
+  ;
+
+  std::ifstream file(path);
+
+  if (!file)
+    {
+      throw std::runtime_error("Can not open lens model " + path);
+    }
+
+  try
+    {
+      po::variables_map vm;
+      po::store(po::parse_config_file(file, desc), vm);
+      po::notify(vm);
+    }
+  catch (const po::error &e)
+    {
+      throw std::runtime_error("Invalid lens model " + path + ": " + e.what());
+    }
+
+  if (!(lens.fx > 0.0 && lens.fy > 0.0))
+    {
+      throw std::runtime_error("Invalid lens model " + path + ": focal length must be positive");
+    }
+
+  return lens;
+}
+
+i3ds::Undistortion::Undistortion(const LensModel &lens, UndistortMode mode, int max_pixels)
+  : lens_(lens),
+    mode_(mode),
+    depth_(max_pixels),
+    confidence_(max_pixels),
+    intensity_(max_pixels)
+{
+}
+
+i3ds::Undistortion::TablePtr
+i3ds::Undistortion::build(int offset_x, int offset_y, int width, int height) const
+{
+  std::shared_ptr<Table> table(new Table);
+
+  table->offset_x = offset_x;
+  table->offset_y = offset_y;
+  table->width = width;
+  table->height = height;
+  table->entries.resize(width * height);
+
+  const LensModel &l = lens_;
+  const bool bilinear = mode_ == undistort_bilinear && width > 1 && height > 1;
+
+  for (int v = 0; v < height; v++)
+    {
+      for (int u = 0; u < width; u++)
+        {
+          const double x = (u + offset_x - l.cx) / l.fx;
+          const double y = (v + offset_y - l.cy) / l.fy;
+          const double r2 = x * x + y * y;
+          const double radial = 1.0 + r2 * (l.k1 + r2 * (l.k2 + r2 * l.k3));
+          const double xd = x * radial + 2.0 * l.p1 * x * y + l.p2 * (r2 + 2.0 * x * x);
+          const double yd = y * radial + l.p1 * (r2 + 2.0 * y * y) + 2.0 * l.p2 * x * y;
+
+          // Source in region pixels.
+          const double su = l.fx * xd + l.cx - offset_x;
+          const double sv = l.fy * yd + l.cy - offset_y;
+
+          Entry &e = table->entries[v * width + u];
+
+          e.source = -1;
+          e.ax = 0;
+          e.ay = 0;
+
+          if (bilinear)
+            {
+              if (su < 0.0 || sv < 0.0 || su > width - 1 || sv > height - 1)
+                {
+                  continue;
+                }
+
+              const int x0 = std::min((int) su, width - 2);
+              const int y0 = std::min((int) sv, height - 2);
+
+              e.source = y0 * width + x0;
+              e.ax = (uint8_t) std::lround((su - x0) * (1 << frac_bits));
+              e.ay = (uint8_t) std::lround((sv - y0) * (1 << frac_bits));
+            }
+          else
+            {
+              const long x0 = std::lround(su);
+              const long y0 = std::lround(sv);
+
+              if (x0 < 0 || y0 < 0 || x0 >= width || y0 >= height)
+                {
+                  continue;
+                }
+
+              e.source = (int32_t) (y0 * width + x0);
+            }
+        }
+    }
+
+  return table;
+}
+
+void
+i3ds::Undistortion::prepare(int offset_x, int offset_y, int width, int height)
+{
+  TablePtr table = build(offset_x, offset_y, width, height);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  prepared_ = table;
+}
+
+void
+i3ds::Undistortion::apply(const uint16_t *&depth, const uint16_t *&confidence, const uint16_t *&intensity,
+                          int width, int height, int offset_x, int offset_y)
+{
+  if (!current_ || !current_->matches(offset_x, offset_y, width, height))
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (prepared_ && prepared_->matches(offset_x, offset_y, width, height))
+          {
+            current_ = prepared_;
+          }
+      }
+
+      // Region was not prepared, built on this frame.
+      if (!current_ || !current_->matches(offset_x, offset_y, width, height))
+        {
+          current_ = build(offset_x, offset_y, width, height);
+        }
+    }
+
+  if (mode_ == undistort_bilinear && width > 1 && height > 1)
+    {
+      remap_bilinear(*current_, depth, confidence, intensity);
+    }
+  else
+    {
+      remap_nearest(*current_, depth, confidence, intensity);
+    }
+
+  depth = depth_.data();
+  confidence = confidence_.data();
+
+  if (intensity)
+    {
+      intensity = intensity_.data();
+    }
+}
+
+void
+i3ds::Undistortion::remap_nearest(const Table &table, const uint16_t *depth, const uint16_t *confidence,
+                                  const uint16_t *intensity)
+{
+  const Entry *entries = table.entries.data();
+  const int size = table.width * table.height;
+
+  uint16_t *d = depth_.data();
+  uint16_t *c = confidence_.data();
+  uint16_t *n = intensity_.data();
+
+  for (int i = 0; i < size; i++)
+    {
+      const int32_t s = entries[i].source;
+
+      d[i] = s < 0 ? 0 : depth[s];
+      c[i] = s < 0 ? 0 : confidence[s];
+    }
+
+  if (intensity)
+    {
+      for (int i = 0; i < size; i++)
+        {
+          const int32_t s = entries[i].source;
+
+          n[i] = s < 0 ? 0 : intensity[s];
+        }
+    }
+}
+
+void
+i3ds::Undistortion::remap_bilinear(const Table &table, const uint16_t *depth, const uint16_t *confidence,
+                                   const uint16_t *intensity)
+{
+  const Entry *entries = table.entries.data();
+  const int size = table.width * table.height;
+  const int w = table.width;
+  const uint32_t one = 1 << frac_bits;
+  const uint32_t full = 1 << weight_bits;
+
+  uint16_t *d = depth_.data();
+  uint16_t *c = confidence_.data();
+  uint16_t *n = intensity_.data();
+
+  for (int i = 0; i < size; i++)
+    {
+      const Entry &e = entries[i];
+
+      if (e.source < 0)
+        {
+          d[i] = 0;
+          c[i] = 0;
+          continue;
+        }
+
+      const int32_t k[4] = {e.source, e.source + 1, e.source + w, e.source + w + 1};
+      const uint32_t ax = e.ax, ay = e.ay;
+      const uint32_t weight[4] = {(one - ax) * (one - ay), ax * (one - ay), (one - ax) * ay, ax * ay};
+
+      uint32_t valid = 0, depth_sum = 0, confidence_sum = 0;
+
+      for (int j = 0; j < 4; j++)
+        {
+          const uint32_t dj = depth[k[j]];
+          const uint32_t cj = confidence[k[j]];
+
+          // Zero weight for invalid neighbours, without branches.
+          const uint32_t wv = (dj != 0) & (cj != 0) ? weight[j] : 0;
+
+          valid += wv;
+          depth_sum += wv * dj;
+          confidence_sum += wv * cj;
+        }
+
+      if (2 * valid < full)
+        {
+          d[i] = 0;
+          c[i] = 0;
+        }
+      else if (valid == full)
+        {
+          d[i] = (uint16_t) ((depth_sum + full / 2) >> weight_bits);
+          c[i] = (uint16_t) ((confidence_sum + full / 2) >> weight_bits);
+        }
+      else
+        {
+          d[i] = (uint16_t) ((depth_sum + valid / 2) / valid);
+          c[i] = (uint16_t) ((confidence_sum + valid / 2) / valid);
+        }
+    }
+
+  if (!intensity)
+    {
+      return;
+    }
+
+  for (int i = 0; i < size; i++)
+    {
+      const Entry &e = entries[i];
+
+      if (e.source < 0)
+        {
+          n[i] = 0;
+          continue;
+        }
+
+      const int32_t s = e.source;
+      const uint32_t ax = e.ax, ay = e.ay;
+      const uint32_t top = (one - ax) * intensity[s] + ax * intensity[s + 1];
+      const uint32_t bottom = (one - ax) * intensity[s + w] + ax * intensity[s + w + 1];
+
+      n[i] = (uint16_t) (((one - ay) * top + ay * bottom + full / 2) >> weight_bits);
+    }
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "tof_wire_encoder.hpp"
+
+#include <cstring>
+#include <utility>
+
+#include <asn1crt.h>
+
+// Layout of the measurement in unaligned PER, in field order:
+//   attributes.timestamp  INTEGER, full 64 bit range
+//   attributes.validity   ENUMERATED SampleValidity
+//   region                4 x INTEGER (0..65535)
+//   distances             SEQUENCE (SIZE(0..max_pixels)) OF REAL
+//   validity              SEQUENCE (SIZE(0..max_pixels)) OF ENUMERATED DepthValidity
+//
+// Sizes and ranges are checked against the generated code at compile time,
+// so a change of the ASN.1 definition fails the build.
+typedef i3ds::ToFCamera::MeasurementTopic::Data Measurement;
+
+static const asn1SccSint max_pixels = sizeof(std::declval<Measurement &>().distances.arr)
+                                      / sizeof(std::declval<Measurement &>().distances.arr[0]);
+static const asn1SccSint sample_validity_max = 2;
+static const asn1SccSint depth_validity_max = 3;
+
+// Bits of a constrained whole number in 0..max.
+static constexpr int range_bits(asn1SccSint max)
+{
+  return max > 0 ? 1 + range_bits(max / 2) : 0;
+}
+
+static_assert(sizeof(std::declval<Measurement &>().validity.arr) / sizeof(std::declval<Measurement &>().validity.arr[0])
+              == max_pixels, "Distances and validity differ in size");
+static_assert(range_bits(sample_validity_max) == SampleValidity_REQUIRED_BITS_FOR_ENCODING,
+              "SampleValidity differs from the encoder");
+static_assert(range_bits(depth_validity_max) == DepthValidity_REQUIRED_BITS_FOR_ENCODING,
+              "DepthValidity differs from the encoder");
+static_assert(sample_valid <= sample_validity_max && depth_valid <= depth_validity_max &&
+              depth_range_error <= depth_validity_max, "Validity out of the encoded range");
+
+i3ds::ToFWireEncoder::ToFWireEncoder()
+  : buffer_(ToFCamera::MeasurementTopic::Codec::max_size), size_(0)
+{
+}
+
+void
+i3ds::ToFWireEncoder::Encode(const uint16_t *depth, const uint16_t *confidence, const PlanarRegion &region,
+                             const DepthScale &scale, Timepoint timestamp)
+{
+  const asn1SccSint size = region.size_x * region.size_y;
+
+  BitStream stream;
+  BitStream_Init(&stream, buffer_.data(), buffer_.size());
+
+  BitStream_EncodeConstraintWholeNumber(&stream, timestamp, INT64_MIN, INT64_MAX);
+  BitStream_EncodeConstraintWholeNumber(&stream, sample_valid, 0, sample_validity_max);
+
+  BitStream_EncodeConstraintWholeNumber(&stream, region.offset_x, 0, 65535);
+  BitStream_EncodeConstraintWholeNumber(&stream, region.offset_y, 0, 65535);
+  BitStream_EncodeConstraintWholeNumber(&stream, region.size_x, 0, 65535);
+  BitStream_EncodeConstraintWholeNumber(&stream, region.size_y, 0, 65535);
+
+  BitStream_EncodeConstraintWholeNumber(&stream, size, 0, max_pixels);
+
+  for (asn1SccSint i = 0; i < size; i++)
+    {
+      BitStream_EncodeReal(&stream, scale(depth[i]));
+    }
+
+  BitStream_EncodeConstraintWholeNumber(&stream, size, 0, max_pixels);
+
+  for (asn1SccSint i = 0; i < size; i++)
+    {
+      const DepthValidity validity = valid_depth(depth[i], confidence[i]) ? depth_valid : depth_range_error;
+
+      BitStream_EncodeConstraintWholeNumber(&stream, validity, 0, depth_validity_max);
+    }
+
+  size_ = BitStream_GetLength(&stream);
+}
+
+bool
+i3ds::ToFWireEncoder::Matches(const ToFCamera::MeasurementTopic::Data &frame)
+{
+  reference_.resize(buffer_.size());
+
+  BitStream stream;
+  BitStream_Init(&stream, reference_.data(), reference_.size());
+
+  int error = 0;
+
+  if (!ToFCamera::MeasurementTopic::Codec::Encode(&frame, &stream, &error, true))
+    {
+      return false;
+    }
+
+  return (size_t) BitStream_GetLength(&stream) == size_ && memcmp(reference_.data(), buffer_.data(), size_) == 0;
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "trace_ring.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+const char *
+i3ds::trace_stage_name(uint32_t stage)
+{
+  static const char *names[] =
+  {
+    "unknown",
+    "grab_ok",
+    "grab_timeout",
+    "grab_failed",
+    "grab_disconnected",
+    "region_commit",
+    "sample_start",
+    "sample_skipped",
+    "sample_converted",
+    "sample_posted",
+    "sample_published",
+    "grab_gap"
+  };
+
+  return stage < trace_stage_end ? names[stage] : names[0];
+}
+
+i3ds::TraceRing &
+i3ds::TraceRing::Global()
+{
+  static TraceRing ring;
+  return ring;
+}
+
+i3ds::TraceRing::TraceRing()
+  : head_(0)
+{
+  for (size_t i = 0; i < size; i++)
+    {
+      slots_[i].seq = 0;
+    }
+}
+
+long
+i3ds::TraceRing::Dump(const std::string &path) const
+{
+  std::vector<TraceRecord> records;
+  records.reserve(size);
+
+  for (size_t i = 0; i < size; i++)
+    {
+      const Slot &slot = slots_[i];
+
+      TraceRecord record;
+
+      record.seq = slot.seq.load(std::memory_order_acquire);
+      record.time = slot.time.load(std::memory_order_relaxed);
+      record.frame = slot.frame.load(std::memory_order_relaxed);
+
+      const uint64_t data = slot.data.load(std::memory_order_relaxed);
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // Skip slots never written or rewritten while being read.
+      if (record.seq == 0 || record.seq != slot.seq.load(std::memory_order_relaxed))
+        {
+          continue;
+        }
+
+      record.stage = (uint32_t) (data >> 32);
+      record.arg = (uint32_t) data;
+
+      records.push_back(record);
+    }
+
+  std::sort(records.begin(), records.end(),
+            [](const TraceRecord &a, const TraceRecord &b) {return a.seq < b.seq;});
+
+  FILE *file = fopen(path.c_str(), "wb");
+
+  if (!file)
+    {
+      return -1;
+    }
+
+  const uint64_t count = records.size();
+
+  bool ok = fwrite(trace_magic, sizeof(trace_magic), 1, file) == 1;
+  ok = ok && fwrite(&count, sizeof(count), 1, file) == 1;
+  ok = ok && (count == 0 || fwrite(records.data(), sizeof(TraceRecord), count, file) == count);
+
+  ok = (fclose(file) == 0) && ok;
+
+  return ok ? (long) count : -1;
+}
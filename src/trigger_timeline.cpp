@@ -0,0 +1,127 @@
+///////////////////////////////////////////////////////////////////////////\file
+///
+///   Copyright 2018 SINTEF AS
+///
+///   This Source Code Form is subject to the terms of the Mozilla
+///   Public License, v. 2.0. If a copy of the MPL was not distributed
+///   with this file, You can obtain one at https://mozilla.org/MPL/2.0/
+///
+////////////////////////////////////////////////////////////////////////////////
+
+#include "trigger_timeline.hpp"
+
+#include <limits>
+
+static const int64_t no_latency = std::numeric_limits<int64_t>::max();
+
+i3ds::TriggerTimeline::TriggerTimeline()
+  : epoch_(0), period_(0), offset_(0), last_index_(-1),
+    min_latency_(no_latency), max_latency_(0), missed_(0)
+{
+}
+
+void
+i3ds::TriggerTimeline::start(int64_t epoch, int64_t period, int64_t offset)
+{
+  epoch_ = epoch;
+  period_ = period;
+  offset_ = offset;
+  last_index_ = -1;
+  missed_ = 0;
+}
+
+void
+i3ds::TriggerTimeline::stop()
+{
+  period_ = 0;
+}
+
+int64_t
+i3ds::TriggerTimeline::pulse(int64_t t, int64_t *index) const
+{
+  const int64_t period = period_;
+
+  if (period <= 0)
+    {
+      if (index)
+        {
+          *index = 0;
+        }
+
+      return t;
+    }
+
+  const int64_t first = epoch_ + offset_;
+  const int64_t k = t >= first ? (t - first) / period : -1;
+
+  if (index)
+    {
+      *index = k;
+    }
+
+  return first + k * period;
+}
+
+int64_t
+i3ds::TriggerTimeline::arrival(int64_t t)
+{
+  int64_t index;
+  int64_t latency = t - pulse(t, &index);
+
+  // Arrived before the first pulse, the generator started earlier.
+  if (index < 0)
+    {
+      epoch_ -= period_ - latency;
+      latency = 0;
+      index = 0;
+      last_index_ = -1;
+    }
+
+  if (last_index_ >= 0 && index > last_index_ + 1)
+    {
+      missed_ += index - last_index_ - 1;
+    }
+
+  last_index_ = index;
+
+  grab_.record(latency);
+
+  if (latency < min_latency_)
+    {
+      min_latency_ = latency;
+    }
+
+  if (latency > max_latency_)
+    {
+      max_latency_ = latency;
+    }
+
+  return latency;
+}
+
+void
+i3ds::TriggerTimeline::published(int64_t grabbed, int64_t sent)
+{
+  // Published from another thread, may be after stop.
+  if (running())
+    {
+      publish_.record(sent - pulse(grabbed, nullptr));
+    }
+}
+
+i3ds::TriggerTimeline::Snapshot
+i3ds::TriggerTimeline::take()
+{
+  Snapshot s;
+
+  s.grab = grab_.take();
+  s.publish = publish_.take();
+
+  const int64_t min = min_latency_.exchange(no_latency);
+  const int64_t max = max_latency_.exchange(0);
+
+  s.jitter = max >= min ? max - min : 0;
+  s.missed = missed_;
+
+  return s;
+}